@@ -4,11 +4,14 @@
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
+#include "userprog/syscall.h"
 
 /* A directory. */
 struct dir 
@@ -27,6 +30,16 @@ struct dir_entry
     bool isdir;                         /* is this entry dir? */
   };
 
+/* Cache of open directories. */
+static struct slab_cache dir_cache;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  slab_cache_init (&dir_cache, "dir", sizeof (struct dir), NULL);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -51,9 +64,10 @@ dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 struct dir *
 dir_open (struct inode *inode) 
 {
-  struct dir *dir = calloc (1, sizeof *dir);
+  struct dir *dir = slab_alloc (&dir_cache);
   if (inode != NULL && dir != NULL)
     {
+      inode_set_journaled (inode);
       dir->inode = inode;
       dir->pos = 0;
       return dir;
@@ -61,7 +75,7 @@ dir_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (dir);
+      slab_free (&dir_cache, dir);
       return NULL; 
     }
 }
@@ -89,7 +103,7 @@ dir_close (struct dir *dir)
   if (dir != NULL)
     {
       inode_close (dir->inode);
-      free (dir);
+      slab_free (&dir_cache, dir);
     }
   dir = NULL;
 }
@@ -354,11 +368,15 @@ mkdir_by_name (char* name, struct dir* dir)
     return false;
   }
   block_sector_t inode_sector = 0;
+  bool filelock = filelock_acquire ();
+  journal_begin ();
   bool success = (free_map_allocate (1, &inode_sector)
                   && dir_create (inode_sector, 16, inode_get_inumber(path->inode))
                   && dir_add (path, name_copy, inode_sector, true));
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
+  journal_end ();
+  filelock_release (filelock);
   
 //  lock_release (inode_dir_lock (path->inode));
   dir_close (path);
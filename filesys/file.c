@@ -1,7 +1,9 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "threads/lockstat.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "filesys/filesys.h"
 #include "threads/vaddr.h"
 #include "devices/block.h"
@@ -15,13 +17,23 @@ struct file
     bool deny_write;            /* Has file_deny_write() been called? */
   };
 
+/* Cache of open files. */
+static struct slab_cache file_cache;
+
+/* Initializes the file module. */
+void
+file_init (void)
+{
+  slab_cache_init (&file_cache, "file", sizeof (struct file), NULL);
+}
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
 struct file *
 file_open (struct inode *inode) 
 {
-  struct file *file = calloc (1, sizeof *file);
+  struct file *file = slab_alloc (&file_cache);
   if (inode != NULL && file != NULL)
     {
       file->inode = inode;
@@ -32,7 +44,7 @@ file_open (struct inode *inode)
   else
     {
       inode_close (inode);
-      free (file);
+      slab_free (&file_cache, file);
       return NULL; 
     }
 }
@@ -53,7 +65,7 @@ file_close (struct file *file)
     {
       file_allow_write (file);
       inode_close (file->inode);
-      free (file); 
+      slab_free (&file_cache, file); 
     }
 }
 
@@ -104,7 +116,7 @@ file_read_user (struct file *file, void *buffer_, off_t size)
     block = find_cache_block (file->inode, file->pos); 
     if (block == NULL)
       return bytes_read;
-    lock_release (&block->block_lock);
+    lockstat_release (&block->block_lock);
 
     sector_ofs = file->pos % BLOCK_SECTOR_SIZE;
     inode_left = inode_length (file->inode) - file->pos;
@@ -157,7 +169,7 @@ file_read_at_user (struct file *file, void *buffer_, off_t size, off_t file_ofs)
     block = find_cache_block (file->inode, file_ofs); 
     if (block == NULL)
       return bytes_read;
-    lock_release (&block->block_lock);
+    lockstat_release (&block->block_lock);
  
     sector_ofs = file_ofs % BLOCK_SECTOR_SIZE;
     inode_left = inode_length (file->inode) - file_ofs;
@@ -240,7 +252,7 @@ file_write_user (struct file *file, const void *buffer_, off_t size)
     bytes_written += bytes_to_write;
     file->pos += bytes_to_write;
     buffer += bytes_to_write;
-    lock_release (&block->block_lock);
+    lockstat_release (&block->block_lock);
   }
   return bytes_written;
 }
@@ -301,7 +313,7 @@ file_write_at_user (struct file *file, const void *buffer_, off_t size,
     bytes_written += bytes_to_write;
     file_ofs += bytes_to_write;
     buffer += bytes_to_write;
-    lock_release (&block->block_lock);
+    lockstat_release (&block->block_lock);
   }
   return bytes_written;
 
@@ -5,10 +5,13 @@
 
 struct inode;
 
+void file_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
 void file_close (struct file *);
+void file_close_user (struct file *);
 struct inode *file_get_inode (struct file *);
 
 /* Reading and writing. */
@@ -4,14 +4,23 @@
 #include <string.h>
 #include "filesys/file.h"
 #include "filesys/free-map.h"
+#include "filesys/iosched.h"
+#include "filesys/journal.h"
+#include "filesys/warmcache.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "threads/vaddr.h"
+#include "threads/lockstat.h"
 #include "threads/palloc.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "devices/block.h"
 #include "devices/intq.h"
 #include "threads/thread.h"
+#include "userprog/syscall.h"
+#ifdef USERPROG
+#include "userprog/fstrace.h"
+#endif
 
 #define BLOCKMASK BLOCK_SECTOR_SIZE-1
 
@@ -20,6 +29,9 @@ struct block *fs_device;
 
 static void do_format (void);
 
+/* Cache of buffer cache block descriptors. */
+static struct slab_cache cache_block_cache;
+
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void
@@ -31,17 +43,25 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  iosched_init ();
   inode_init ();
+  file_init ();
+  dir_init ();
   free_map_init ();
+  journal_init (format);
+  warmcache_init (format);
 
   if (format) 
     do_format ();
 
   free_map_open ();
+  inode_recover (format);
   
+  slab_cache_init (&cache_block_cache, "cache_block",
+                   sizeof (struct cache_block), NULL);
   for (i = 0; i < 64; i++)
   {
-    buffer_cache[i] = malloc (sizeof *buffer_cache[i]);
+    buffer_cache[i] = slab_alloc (&cache_block_cache);
     buffer_cache[i]->data = malloc (BLOCK_SECTOR_SIZE);
     buffer_cache[i]->accessed = false;
     buffer_cache[i]->dirty = false;
@@ -49,7 +69,7 @@ filesys_init (bool format)
     buffer_cache[i]->block_no = 0;
     buffer_cache[i]->valid = false;
     buffer_cache[i]->size = 0;
-    lock_init (&buffer_cache[i]->block_lock);
+    lock_init_named (&buffer_cache[i]->block_lock, "cache_block");
   }
   buffer_iter = 0; 
   thread_current ()->pwd = dir_open_root (); 
@@ -57,12 +77,22 @@ filesys_init (bool format)
 }
 
 /* Shuts down the file system module, writing any unwritten data
-   to disk. */
+   to disk, and prints the file system's statistics. */
 void
 filesys_done (void) 
 {
+#ifdef USERPROG
+  fstrace_save ();
+#endif
+  inode_done ();
   cache_flush ();
+  journal_done ();
   free_map_close ();
+  warmcache_done ();
+
+  iosched_print_stats ();
+  journal_print_stats ();
+  warmcache_print_stats ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -81,6 +111,8 @@ filesys_create (const char *name, off_t initial_size)
   char* name_copy;
   name_copy = palloc_get_page (0);
   find_dir (name, name_copy, dir);
+  bool filelock = filelock_acquire ();
+  journal_begin ();
   bool success = (path != NULL
                   && (strlen(name_copy) <= NAME_MAX)
                   && free_map_allocate (1, &inode_sector)
@@ -88,6 +120,8 @@ filesys_create (const char *name, off_t initial_size)
                   && dir_add (path, name_copy, inode_sector, false));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
+  journal_end ();
+  filelock_release (filelock);
 palloc_free_page (name_copy);
   dir_close (dir);
   return success;
@@ -146,7 +180,11 @@ filesys_remove (const char *name)
     }
   }
 */
+  bool filelock = filelock_acquire ();
+  journal_begin ();
   bool success = path != NULL && dir_remove (path, name_copy);
+  journal_end ();
+  filelock_release (filelock);
   palloc_free_page (name_copy);
   dir_close (dir); 
 
@@ -157,11 +195,18 @@ filesys_remove (const char *name)
 static void
 do_format (void)
 {
+  bool filelock;
+
   printf ("Formatting file system...");
+  filelock = filelock_acquire ();
+  journal_begin ();
   free_map_create ();
   if (!dir_create (ROOT_DIR_SECTOR, 16, ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
+  journal_end ();
+  filelock_release (filelock);
   free_map_close ();
+  journal_commit ();
   printf ("done.\n");
 }
 
@@ -177,13 +222,15 @@ struct cache_block* find_cache_block (struct inode *inode, off_t pos)
     {
       if (inode == buffer_cache[i]->inode && block_no == buffer_cache[i]->block_no)
       {
-    lock_acquire (&buffer_cache[i]->block_lock);
+    lockstat_acquire (&buffer_cache[i]->block_lock);
+        thread_current ()->stats.cache_hits++;
         return buffer_cache[i];
       }
     }
   }
   // instead of NULL, load file and return that cache block
   // if full, evict and load
+  thread_current ()->stats.cache_misses++;
   return load_inode_block (inode, pos);
 }
 
@@ -203,7 +250,7 @@ struct cache_block* load_inode_block (struct inode *inode, off_t pos)
     if (buffer_cache[i]->valid == false)
     {
       load_dest = buffer_cache[i];
-    lock_acquire (&buffer_cache[i]->block_lock);
+    lockstat_acquire (&buffer_cache[i]->block_lock);
       break;
     }
   }
@@ -237,7 +284,7 @@ int ret;
     {
       ret = buffer_iter;
       cache_write_back (buffer_cache[ret]);
-      lock_acquire (&buffer_cache[ret]->block_lock);
+      lockstat_acquire (&buffer_cache[ret]->block_lock);
       buffer_cache[ret]->valid = false;
       buffer_iter = ( buffer_iter + 1 ) % 64;
       return buffer_cache[ret];
@@ -254,12 +301,12 @@ int written;
   { 
     return false;
   }
-  lock_acquire (&cache_block->block_lock);
+  lockstat_acquire (&cache_block->block_lock);
   written=inode_write_at (cache_block->inode, cache_block->data, cache_block->size, cache_block->block_no * BLOCK_SECTOR_SIZE);
   
 //hex_dump (0, cache_block->data, BLOCK_SECTOR_SIZE, true);
     cache_block->dirty = false;
-  lock_release (&cache_block->block_lock);
+  lockstat_release (&cache_block->block_lock);
     return true;
   
 }
@@ -272,6 +319,7 @@ void cache_flush (void)
   {
       cache_write_back (buffer_cache[i]);
   }
+  inode_flush_all ();
 }
 
 void flush_thread_func (void)
@@ -291,4 +339,5 @@ void file_write_back (struct inode *inode)
       cache_write_back (buffer_cache[i]);
     }
   }
+  inode_flush (inode);
 }
@@ -4,6 +4,9 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "filesys/warmcache.h"
+#include "threads/malloc.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
@@ -17,6 +20,9 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  bitmap_mark (free_map, WARMCACHE_SECTOR);
+  bitmap_mark (free_map, ORPHAN_SECTOR);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -40,12 +46,35 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.
+   Sectors the journal still holds a copy of become available
+   only once the journal lets go of them. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  size_t i;
+
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
+  for (i = 0; i < cnt; i++)
+    if (!journal_defer_release (sector + i))
+      bitmap_reset (free_map, sector + i);
+  bitmap_write (free_map, free_map_file);
+}
+
+/* Makes each of the CNT sectors in SECTORS available for use,
+   as free_map_release() does, but writes the free map out only
+   once for all of them. */
+void
+free_map_release_batch (const block_sector_t *sectors, size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (bitmap_test (free_map, sectors[i]));
+      if (!journal_defer_release (sectors[i]))
+        bitmap_reset (free_map, sectors[i]);
+    }
   bitmap_write (free_map, free_map_file);
 }
 
@@ -73,22 +102,26 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  struct inode_disk *disk_inode = malloc(BLOCK_SECTOR_SIZE);
+  struct inode_disk *disk_inode = calloc(1, BLOCK_SECTOR_SIZE);
   int i;
+  if (disk_inode == NULL)
+    PANIC ("can't create free map inode");
   disk_inode->direct[0] = FREE_MAP_SECTOR;
   for(i = 1; i < 10; i++)
     disk_inode->direct[i] = -1;
   disk_inode->single_level = -1;
   disk_inode->double_level = -1;
+  disk_inode->triple_level = -1;
+  disk_inode->magic = INODE_MAGIC;
   disk_inode->length = bitmap_file_size(free_map);
   bitmap_mark(free_map, FREE_MAP_SECTOR);
 //  free_map_allocate (1, NULL);
-  block_write(fs_device, FREE_MAP_SECTOR, disk_inode);
+  journal_write (FREE_MAP_SECTOR, disk_inode);
+  free (disk_inode);
   /* Write bitmap to file. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
-//  free(disk_inode);
 }
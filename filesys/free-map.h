@@ -13,6 +13,7 @@ void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+void free_map_release_batch (const block_sector_t *, size_t cnt);
 
 struct inode_disk;
 #endif /* filesys/free-map.h */
@@ -2,33 +2,46 @@
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/iosched.h"
+#include "filesys/journal.h"
+#include "threads/lockstat.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "devices/block.h"
 //#include "filesys/cache.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/syscall.h"
 
-/* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/* Entries in an index block. */
+#define INDEX_CNT 128
 
-/* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
-struct inode_disk
+struct inode_disk_level
   {
-    block_sector_t direct[10];
-    block_sector_t single_level;
-    block_sector_t double_level;
-    off_t length;                       /* File size in bytes. */
-    unsigned magic;                     /* Magic number. */
-    uint32_t unused[114];               /* Not used. */
+    block_sector_t index[INDEX_CNT];
   };
 
-struct inode_disk_level
+/* Data sectors mapped by each part of the index: 10 direct
+   pointers, then single-, double- and triple-indirect trees.
+   That is a little over 1 GB, within what off_t can express. */
+#define DIRECT_CNT 10
+#define SINGLE_CNT INDEX_CNT
+#define DOUBLE_CNT (INDEX_CNT * INDEX_CNT)
+#define TRIPLE_CNT (INDEX_CNT * INDEX_CNT * INDEX_CNT)
+#define INODE_MAX_SECTORS (DIRECT_CNT + SINGLE_CNT + DOUBLE_CNT + TRIPLE_CNT)
+
+/* The leaf index block an inode last looked a sector up in, so
+   that mapping the consecutive blocks of a file reads the index
+   tree once per INDEX_CNT blocks instead of once per block. */
+struct index_cache
   {
-    block_sector_t index[128];
+    size_t first;                       /* File block of level.index[0]. */
+    struct inode_disk_level level;      /* Copy of the leaf. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -39,7 +52,27 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* Where a file's data sectors are: the index fields of struct
+   inode_disk. */
+struct inode_index
+  {
+    block_sector_t direct[DIRECT_CNT];
+    block_sector_t single_level;
+    block_sector_t double_level;
+    block_sector_t triple_level;
+  };
+
+/* In-memory inode.
+
+   Rather than a whole struct inode_disk, an open inode keeps only
+   the fields it uses, plus the inline data of an inline file.
+   Changes that only make the file longer or touch inline data
+   set DIRTY, and the inode sector is rewritten from these fields
+   later, by inode_flush(): at the last close, when the file is
+   written back, or when the buffer cache is flushed.  Changes to
+   the index itself, and every change to a journaled (directory
+   or free map) inode, are written through at once, in the
+   caller's transaction. */
 struct inode 
   {
     struct list_elem elem;              /* Element in inode list. */
@@ -47,15 +80,76 @@ struct inode
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;             /* Inode content. */
+    off_t length;                       /* File size in bytes. */
+    uint32_t flags;                     /* INODE_* flags. */
+    struct inode_index index;           /* Data sectors. */
+    uint8_t *inline_data;               /* INODE_INLINE_MAX bytes, or null. */
+    bool dirty;                         /* Newer than the inode sector? */
     struct lock lock;
+    struct readahead *ra;               /* Read-ahead sector, or null. */
+    bool journaled;                     /* Contents are metadata? */
+    struct index_cache *ic;             /* Last leaf looked up, or null. */
+  };
+
+/* Maximum number of requests one inode_read_at() or
+   inode_write_at() keeps in flight. */
+#define INODE_IO_BATCH 16
+
+/* Maximum number of sectors in one of those requests. */
+#define INODE_IO_RUN 32
+
+/* A sector read ahead of a sequential reader.  Owned by the inode
+   and protected by its lock. */
+struct readahead
+  {
+    struct io_request req;              /* Read in flight or done. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static bool readahead_take (struct inode *, block_sector_t, void *);
+static void readahead_cancel (struct inode *, block_sector_t);
+static void readahead_start (struct inode *, off_t);
+
+/* Whole-sector transfers made by one inode_read_at() or
+   inode_write_at().  Sectors that are consecutive both on disk
+   and in the caller's buffer are gathered into runs, and each
+   run goes to the I/O scheduler as a single request. */
+struct io_batch
+  {
+    bool write;                         /* Writing or reading? */
+    struct io_request *reqs;            /* Requests in flight, or null. */
+    int req_cnt;                        /* Number of requests in flight. */
+    block_sector_t run_sector;          /* First sector of current run. */
+    size_t run_cnt;                     /* Sectors in current run. */
+    uint8_t *run_buf;                   /* Buffer for current run. */
   };
 
+static void io_batch_init (struct io_batch *, bool write);
+static void io_batch_add (struct io_batch *, block_sector_t, uint8_t *);
+static void io_batch_flush_run (struct io_batch *);
+static void io_batch_finish (struct io_batch *);
+
+static off_t inline_read (struct inode *, void *, off_t size, off_t offset);
+static off_t inline_write (struct inode *, const void *, off_t size,
+                           off_t offset);
+static void inline_extend (struct inode *, off_t length);
+static bool inline_migrate (struct inode *);
+
 void file_extension(struct inode* inode_, off_t size, off_t offset);
 
 
 
 
+static block_sector_t index_lookup (struct inode *, block_sector_t root,
+                                    int depth, size_t base, size_t idx);
+static bool index_set (struct inode_index *, size_t idx, block_sector_t);
+static bool index_set_level (block_sector_t *root, int depth, size_t idx,
+                             block_sector_t);
+static void index_release (block_sector_t root, int depth);
+static void release_add (block_sector_t);
+static void release_flush (void);
+static void index_cache_drop (struct inode *);
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
@@ -64,42 +158,333 @@ static block_sector_t
 byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  struct inode_disk *disk_inode = &inode->data;
-  int quotient = pos / BLOCK_SECTOR_SIZE;
-  struct inode_disk_level buffer;
-  if (quotient < 10) // direct level
-    return disk_inode->direct[quotient];
-  quotient -= 10;
-  if (quotient < 128) // single level
-  {
-    block_read (fs_device, disk_inode->single_level, &buffer);
-    return buffer.index[quotient];
-  }
-  quotient -= 128;
-  if (quotient < 128 * 128) // double level
-  {
-    int remainder = quotient % 128;
-    quotient = quotient / 128;
-    block_read (fs_device, disk_inode->double_level, &buffer);
-    block_read (fs_device, buffer.index[quotient], &buffer);
-    return buffer.index[remainder];
-  }
+  struct inode_index *index = &inode->index;
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+
+  if (idx < DIRECT_CNT)
+    return index->direct[idx];
+  idx -= DIRECT_CNT;
+  if (idx < SINGLE_CNT)
+    return index_lookup (inode, index->single_level, 1,
+                         DIRECT_CNT, idx);
+  idx -= SINGLE_CNT;
+  if (idx < DOUBLE_CNT)
+    return index_lookup (inode, index->double_level, 2,
+                         DIRECT_CNT + SINGLE_CNT, idx);
+  idx -= DOUBLE_CNT;
+  if (idx < TRIPLE_CNT)
+    return index_lookup (inode, index->triple_level, 3,
+                         DIRECT_CNT + SINGLE_CNT + DOUBLE_CNT, idx);
   return -1; // too large
 }
 
+/* Returns entry IDX of the DEPTH-level index tree rooted at ROOT,
+   which maps INODE's file blocks starting at BASE, or -1 if there
+   is no such entry.  Uses and refills INODE's index cache. */
+static block_sector_t
+index_lookup (struct inode *inode, block_sector_t root, int depth,
+              size_t base, size_t idx)
+{
+  struct inode_disk_level *level;
+  size_t first = base + idx - idx % INDEX_CNT;
+  off_t length = inode->length;
+  block_sector_t sector;
+
+  lockstat_acquire (&inode->lock);
+  if (inode->ic != NULL && inode->ic->first == first)
+    {
+      sector = inode->ic->level.index[idx % INDEX_CNT];
+      lockstat_release (&inode->lock);
+      return sector;
+    }
+  lockstat_release (&inode->lock);
+
+  level = malloc (sizeof *level);
+  if (level == NULL)
+    return -1;
+  for (; depth > 0; depth--)
+    {
+      size_t span = depth == 3 ? DOUBLE_CNT : depth == 2 ? SINGLE_CNT : 1;
+
+      if (root == (block_sector_t) -1)
+        {
+          free (level);
+          return -1;
+        }
+      journal_read (root, level);
+      root = level->index[idx / span];
+      idx %= span;
+    }
+
+  /* LEVEL is now the leaf.  Don't cache it if the file grew
+     meanwhile, since it may be out of date. */
+  lockstat_acquire (&inode->lock);
+  if (inode->ic == NULL && inode->length == length)
+    inode->ic = malloc (sizeof *inode->ic);
+  if (inode->ic != NULL && inode->length == length)
+    {
+      inode->ic->first = first;
+      inode->ic->level = *level;
+    }
+  lockstat_release (&inode->lock);
+  free (level);
+  return root;
+}
+
+/* Sets file block IDX in INDEX to SECTOR, allocating index
+   blocks as needed.  Returns false if an index block could not
+   be allocated or IDX is too large. */
+static bool
+index_set (struct inode_index *index, size_t idx, block_sector_t sector)
+{
+  if (idx < DIRECT_CNT)
+    {
+      index->direct[idx] = sector;
+      return true;
+    }
+  idx -= DIRECT_CNT;
+  if (idx < SINGLE_CNT)
+    return index_set_level (&index->single_level, 1, idx, sector);
+  idx -= SINGLE_CNT;
+  if (idx < DOUBLE_CNT)
+    return index_set_level (&index->double_level, 2, idx, sector);
+  idx -= DOUBLE_CNT;
+  if (idx < TRIPLE_CNT)
+    return index_set_level (&index->triple_level, 3, idx, sector);
+  return false;
+}
+
+/* Sets entry IDX of the DEPTH-level index tree rooted at *ROOT to
+   SECTOR.  If *ROOT is -1, allocates it first.  Index blocks are
+   written through the journal, and only if they changed. */
+static bool
+index_set_level (block_sector_t *root, int depth, size_t idx,
+                 block_sector_t sector)
+{
+  size_t span = depth == 3 ? DOUBLE_CNT : depth == 2 ? SINGLE_CNT : 1;
+  struct inode_disk_level *level;
+  block_sector_t *entry, old;
+  bool fresh = false;
+  bool success;
+
+  level = malloc (sizeof *level);
+  if (level == NULL)
+    return false;
+  if (*root == (block_sector_t) -1)
+    {
+      block_sector_t new_root;
+
+      if (!free_map_allocate (1, &new_root))
+        {
+          free (level);
+          return false;
+        }
+      *root = new_root;
+      memset (level, 0xff, sizeof *level);
+      fresh = true;
+    }
+  else
+    journal_read (*root, level);
+
+  entry = &level->index[idx / span];
+  old = *entry;
+  if (depth == 1)
+    {
+      *entry = sector;
+      success = true;
+    }
+  else
+    success = index_set_level (entry, depth - 1, idx % span, sector);
+
+  if (fresh || *entry != old)
+    journal_write (*root, level);
+  free (level);
+  return success;
+}
+
+/* Releases the DEPTH-level index tree rooted at ROOT, or the data
+   sector ROOT if DEPTH is 0, through release_add().  Does nothing
+   if ROOT is -1.  release_lock must be held. */
+static void
+index_release (block_sector_t root, int depth)
+{
+  struct inode_disk_level *level;
+  int i;
+
+  if (root == (block_sector_t) -1)
+    return;
+  if (depth > 0)
+    {
+      level = malloc (sizeof *level);
+      if (level == NULL)
+        PANIC ("inode: out of memory freeing index block");
+      journal_read (root, level);
+      for (i = 0; i < INDEX_CNT && level->index[i] != (block_sector_t) -1;
+           i++)
+        index_release (level->index[i], depth - 1);
+      free (level);
+    }
+  release_add (root);
+}
+
+/* Forgets INODE's cached index block, which may have changed. */
+static void
+index_cache_drop (struct inode *inode)
+{
+  struct index_cache *ic;
+
+  lockstat_acquire (&inode->lock);
+  ic = inode->ic;
+  inode->ic = NULL;
+  lockstat_release (&inode->lock);
+  free (ic);
+}
+
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
 
+/* Inodes that nobody has open any more, most recently closed
+   first.  inode_open() revives one of these without reading its
+   sector again.  At most INODE_CLOSED_MAX are kept, about 32 kB
+   plus the data of inline files, and all of them are given up if
+   memory runs out. */
+#define INODE_CLOSED_MAX 256
+static struct list closed_inodes;
+static size_t closed_cnt;
+
+/* Protects open_inodes and closed_inodes. */
+static struct lock inode_list_lock;
+
+/* inode_flush()'s buffer when malloc() fails. */
+static struct inode_disk flush_buffer;
+static struct lock flush_lock;          /* Protects flush_buffer. */
+
+/* Removed inodes whose last opener has closed them, waiting for
+   the "reclaim" thread to free their sectors, so that closing a
+   large removed file does not stall the closer. */
+static struct list reclaim_list;
+static struct lock reclaim_lock;        /* Protects the members below. */
+static struct condition reclaim_more;   /* Signaled on new work. */
+static struct condition reclaim_idle;   /* Signaled when caught up. */
+static bool reclaim_busy;               /* Reclaiming an inode? */
+
+/* Orphan list, in sector ORPHAN_SECTOR: removed inodes whose
+   sectors are not yet free.  inode_remove() adds an inode in the
+   transaction that unlinks it, and inode_free() takes it off in
+   the transaction that frees its sectors, so that after a crash
+   in between inode_recover() can finish the job instead of the
+   sectors leaking.  An inode removed while the list is full is
+   freed by inode_close() itself, in its caller's transaction. */
+#define ORPHAN_MAGIC 0x4f525048         /* "ORPH". */
+#define ORPHAN_MAX 126
+struct orphan_disk
+  {
+    unsigned magic;                     /* ORPHAN_MAGIC. */
+    uint32_t cnt;                       /* Number of orphans. */
+    block_sector_t sectors[ORPHAN_MAX]; /* Their inode sectors. */
+  };
+static struct orphan_disk *orphans;     /* Protected by reclaim_lock. */
+
+/* Sectors freed by inode_free() are collected here and handed to
+   free_map_release_batch() together, so that the free map is
+   written once per batch instead of once per sector. */
+#define RELEASE_BATCH 1024
+static block_sector_t release_sectors[RELEASE_BATCH];
+static size_t release_cnt;
+static struct lock release_lock;        /* Protects the batch. */
+
+static void inode_evict (void);
+static void inode_forget (block_sector_t);
+static bool inode_load (struct inode *, const struct inode_disk *);
+static void reclaim_thread (void *aux);
+static void inode_free (struct inode *);
+static bool orphan_find (block_sector_t, size_t *idx);
+static bool orphan_add (block_sector_t);
+static void orphan_remove (block_sector_t);
+static void inode_store (const struct inode *, struct inode_disk *);
+static void inode_discard (struct inode *);
+
+/* Cache of in-memory inodes. */
+static struct slab_cache inode_cache;
+
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  list_init (&closed_inodes);
+  lock_init_named (&inode_list_lock, "inode_list");
+  lock_init_named (&flush_lock, "inode_flush");
+  slab_cache_init (&inode_cache, "inode", sizeof (struct inode), NULL);
+
+  list_init (&reclaim_list);
+  lock_init_named (&reclaim_lock, "reclaim");
+  lock_init_named (&release_lock, "release");
+  cond_init (&reclaim_more);
+  cond_init (&reclaim_idle);
+  orphans = malloc (sizeof *orphans);
+  if (orphans == NULL)
+    PANIC ("inode: out of memory for orphan list");
+  thread_create ("reclaim", PRI_DEFAULT, reclaim_thread, NULL);
+}
+
+/* Reads the orphan list and hands the inodes on it to the
+   reclaim thread, to finish removals that a crash cut short.
+   If FORMAT is true, the file system is new, so the list is
+   cleared instead.  The free map must be open. */
+void
+inode_recover (bool format)
+{
+  block_sector_t *sectors;
+  size_t i, cnt;
+
+  journal_begin ();
+  if (!format)
+    journal_read (ORPHAN_SECTOR, orphans);
+  if (format || orphans->magic != ORPHAN_MAGIC || orphans->cnt > ORPHAN_MAX)
+    {
+      memset (orphans, 0, sizeof *orphans);
+      orphans->magic = ORPHAN_MAGIC;
+      journal_write (ORPHAN_SECTOR, orphans);
+    }
+  journal_end ();
+
+  /* Closing an orphan, removed and listed, queues it.  The
+     reclaim thread may reorder the list meanwhile, so work from
+     a copy. */
+  cnt = orphans->cnt;
+  if (cnt == 0)
+    return;
+  sectors = malloc (cnt * sizeof *sectors);
+  if (sectors == NULL)
+    return;
+  memcpy (sectors, orphans->sectors, cnt * sizeof *sectors);
+  printf ("inode: reclaiming %zu removed inodes\n", cnt);
+  for (i = 0; i < cnt; i++)
+    {
+      struct inode *inode = inode_open (sectors[i]);
+      if (inode != NULL)
+        {
+          inode_remove (inode);
+          inode_close (inode);
+        }
+    }
+  free (sectors);
 }
 
-/* Initializes an inode with 0 bytes of file data and
-   writes the new inode to sector SECTOR on the file system
+/* Waits until every removed inode has been reclaimed. */
+void
+inode_done (void)
+{
+  lockstat_acquire (&reclaim_lock);
+  while (!list_empty (&reclaim_list) || reclaim_busy)
+    cond_wait (&reclaim_idle, &reclaim_lock);
+  lockstat_release (&reclaim_lock);
+}
+
+/* Initializes an inode with 0 bytes of file data, stored inline,
+   and writes the new inode to sector SECTOR on the file system
    device.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
@@ -115,6 +500,9 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  /* SECTOR may have held an inode that was since freed. */
+  inode_forget (sector);
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
@@ -123,10 +511,12 @@ inode_create (block_sector_t sector, off_t length)
 	disk_inode->direct[i] = -1;
       disk_inode->single_level = -1;
       disk_inode->double_level = -1;
+      disk_inode->triple_level = -1;
       disk_inode->length = 0;
       disk_inode->magic = INODE_MAGIC;
+      disk_inode->flags = INODE_INLINE;
       
-      block_write(fs_device, sector, disk_inode);
+      journal_write (sector, disk_inode);
       success = true;
       free (disk_inode);
     }
@@ -142,6 +532,9 @@ inode_open (block_sector_t sector)
 {
   struct list_elem *e;
   struct inode *inode;
+  struct inode_disk *disk_inode;
+
+  lockstat_acquire (&inode_list_lock);
 
   /* Check whether this inode is already open. */
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
@@ -151,23 +544,64 @@ inode_open (block_sector_t sector)
       if (inode->sector == sector) 
         {
           inode_reopen (inode);
+          lockstat_release (&inode_list_lock);
           return inode; 
         }
     }
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
+  /* Revive it if it was closed recently. */
+  for (e = list_begin (&closed_inodes); e != list_end (&closed_inodes);
+       e = list_next (e))
+    {
+      inode = list_entry (e, struct inode, elem);
+      if (inode->sector == sector)
+        {
+          list_remove (&inode->elem);
+          closed_cnt--;
+          list_push_front (&open_inodes, &inode->elem);
+          inode->open_cnt = 1;
+          lockstat_release (&inode_list_lock);
+          return inode;
+        }
+    }
+
+  /* Allocate memory, giving up closed inodes if there is none. */
+  inode = slab_alloc (&inode_cache);
+  while (inode == NULL && closed_cnt > 0)
+    {
+      inode_evict ();
+      inode = slab_alloc (&inode_cache);
+    }
+  disk_inode = malloc (sizeof *disk_inode);
+  if (inode == NULL || disk_inode == NULL)
+    {
+      slab_free (&inode_cache, inode);
+      free (disk_inode);
+      lockstat_release (&inode_list_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  lock_init(&inode->lock);
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->ra = NULL;
+  inode->ic = NULL;
+  inode->journaled = sector == FREE_MAP_SECTOR;
+  journal_read (inode->sector, disk_inode);
+  if (!inode_load (inode, disk_inode))
+    {
+      slab_free (&inode_cache, inode);
+      free (disk_inode);
+      lockstat_release (&inode_list_lock);
+      return NULL;
+    }
+  free (disk_inode);
+  lock_init_named (&inode->lock, "inode");
+  list_push_front (&open_inodes, &inode->elem);
+
+  lockstat_release (&inode_list_lock);
   return inode;
 }
 
@@ -188,8 +622,9 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, moves it to the list
+   of closed inodes, or, if INODE was also a removed inode, frees
+   its memory and its blocks. */
 void
 inode_close (struct inode *inode) 
 {
@@ -197,78 +632,346 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  lockstat_acquire (&inode_list_lock);
+  if (inode->open_cnt > 1)
+    {
+      inode->open_cnt--;
+      lockstat_release (&inode_list_lock);
+      return;
+    }
+
+  /* This looks like the last opener.  inode_flush() below needs
+     a journal handle, which must not be waited for while holding
+     inode_list_lock.  Our reference keeps anyone else from
+     taking this path meanwhile; recheck once we have the handle,
+     since INODE may have been reopened. */
+  lockstat_release (&inode_list_lock);
+  journal_begin ();
+  lockstat_acquire (&inode_list_lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
-      if (inode->removed) 
+      lockstat_release (&inode_list_lock);
+      journal_end ();
+      return;
+    }
+
+  /* Remove from inode list and release lock. */
+  list_remove (&inode->elem);
+  readahead_cancel (inode, (block_sector_t) -1);
+
+  if (!inode->removed)
+    {
+      /* Keep it, clean, for a later inode_open(). */
+      inode_flush (inode);
+      list_push_front (&closed_inodes, &inode->elem);
+      if (++closed_cnt > INODE_CLOSED_MAX)
+        inode_evict ();
+      lockstat_release (&inode_list_lock);
+    }
+  else
+    {
+      /* Nobody can find INODE any more.  If it is on the orphan
+         list, have its blocks deallocated in the background;
+         otherwise a crash would leak them, so free them now. */
+      lockstat_release (&inode_list_lock);
+      lockstat_acquire (&reclaim_lock);
+      if (orphan_find (inode->sector, NULL))
+        {
+          list_push_back (&reclaim_list, &inode->elem);
+          cond_signal (&reclaim_more, &reclaim_lock);
+          inode = NULL;
+        }
+      lockstat_release (&reclaim_lock);
+      if (inode != NULL)
+        inode_free (inode);
+    }
+  journal_end ();
+}
+
+/* Reclaims removed inodes as inode_close() queues them. */
+static void
+reclaim_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct inode *inode;
+
+      lockstat_acquire (&reclaim_lock);
+      reclaim_busy = false;
+      while (list_empty (&reclaim_list))
+        {
+          cond_broadcast (&reclaim_idle, &reclaim_lock);
+          cond_wait (&reclaim_more, &reclaim_lock);
+        }
+      inode = list_entry (list_pop_front (&reclaim_list), struct inode, elem);
+      reclaim_busy = true;
+      lockstat_release (&reclaim_lock);
+
+      /* FILELOCK keeps file_extension() from allocating while the
+         free map changes.  One transaction covers the whole
+         inode, so a crash frees all of it or none. */
+      lockstat_acquire (&FILELOCK);
+      journal_begin ();
+      inode_free (inode);
+      journal_end ();
+      lockstat_release (&FILELOCK);
+    }
+}
+
+/* Frees removed INODE's sectors, its own included, takes it off
+   the orphan list, and frees INODE itself, all in the caller's
+   transaction. */
+static void
+inode_free (struct inode *inode)
+{
+  int i;
+
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lockstat_acquire (&release_lock);
+  release_add (inode->sector); // inode_disk
+  for (i = 0; i < DIRECT_CNT; i++)
+    index_release (inode->index.direct[i], 0);
+  index_release (inode->index.single_level, 1);
+  index_release (inode->index.double_level, 2);
+  index_release (inode->index.triple_level, 3);
+  release_flush ();
+  lockstat_release (&release_lock);
+
+  lockstat_acquire (&reclaim_lock);
+  orphan_remove (inode->sector);
+  lockstat_release (&reclaim_lock);
+
+  inode_discard (inode);
+}
+
+/* Adds SECTOR to the batch of sectors to free, freeing the batch
+   if it is full. */
+static void
+release_add (block_sector_t sector)
+{
+  if (release_cnt == RELEASE_BATCH)
+    release_flush ();
+  release_sectors[release_cnt++] = sector;
+}
+
+/* Frees the batch of sectors collected by release_add().
+   release_lock must be held. */
+static void
+release_flush (void)
+{
+  if (release_cnt == 0)
+    return;
+  free_map_release_batch (release_sectors, release_cnt);
+  release_cnt = 0;
+}
+
+/* Returns true if SECTOR is on the orphan list, and stores its
+   position in *IDX if IDX is non-null.  reclaim_lock must be
+   held. */
+static bool
+orphan_find (block_sector_t sector, size_t *idx)
+{
+  size_t i;
+
+  for (i = 0; i < orphans->cnt; i++)
+    if (orphans->sectors[i] == sector)
+      {
+        if (idx != NULL)
+          *idx = i;
+        return true;
+      }
+  return false;
+}
+
+/* Adds SECTOR to the orphan list in the running transaction.
+   Returns false if the list is full.  reclaim_lock must be
+   held. */
+static bool
+orphan_add (block_sector_t sector)
+{
+  if (orphan_find (sector, NULL))
+    return true;
+  if (orphans->cnt >= ORPHAN_MAX)
+    return false;
+  orphans->sectors[orphans->cnt++] = sector;
+  journal_write (ORPHAN_SECTOR, orphans);
+  return true;
+}
+
+/* Removes SECTOR, if present, from the orphan list in the
+   running transaction.  reclaim_lock must be held. */
+static void
+orphan_remove (block_sector_t sector)
+{
+  size_t i;
+
+  if (!orphan_find (sector, &i))
+    return;
+  orphans->sectors[i] = orphans->sectors[--orphans->cnt];
+  journal_write (ORPHAN_SECTOR, orphans);
+}
+
+/* Writes INODE back to its sector, through the journal, if it
+   has changed since it was last written.  Falls back to
+   flush_buffer when memory is short, so that it always
+   succeeds. */
+void
+inode_flush (struct inode *inode)
+{
+  struct inode_disk *disk_inode;
+  bool spare;
+
+  if (!inode->dirty)
+    return;
+
+  journal_begin ();
+  disk_inode = malloc (sizeof *disk_inode);
+  spare = disk_inode == NULL;
+  if (spare)
+    {
+      lockstat_acquire (&flush_lock);
+      disk_inode = &flush_buffer;
+    }
+  lockstat_acquire (&inode->lock);
+  inode_store (inode, disk_inode);
+  journal_write (inode->sector, disk_inode);
+  inode->dirty = false;
+  lockstat_release (&inode->lock);
+  if (spare)
+    lockstat_release (&flush_lock);
+  else
+    free (disk_inode);
+  journal_end ();
+}
+
+/* Writes back every open inode that has changed.  Closed inodes
+   are always clean. */
+void
+inode_flush_all (void)
+{
+  struct list_elem *e;
+
+  journal_begin ();
+  lockstat_acquire (&inode_list_lock);
+  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
+       e = list_next (e))
+    inode_flush (list_entry (e, struct inode, elem));
+  lockstat_release (&inode_list_lock);
+  journal_end ();
+}
+
+/* Frees the least recently closed inode.  inode_list_lock must
+   be held. */
+static void
+inode_evict (void)
+{
+  struct inode *inode;
+
+  ASSERT (closed_cnt > 0);
+  inode = list_entry (list_pop_back (&closed_inodes), struct inode, elem);
+  closed_cnt--;
+  inode_discard (inode);
+}
+
+/* Frees in-memory INODE, which nobody has open. */
+static void
+inode_discard (struct inode *inode)
+{
+  index_cache_drop (inode);
+  free (inode->inline_data);
+  lockstat_forget (&inode->lock);
+  slab_free (&inode_cache, inode);
+}
+
+/* Frees the closed inode for SECTOR, if there is one, so that it
+   is not revived after SECTOR gets a new inode. */
+static void
+inode_forget (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  lockstat_acquire (&inode_list_lock);
+  for (e = list_begin (&closed_inodes); e != list_end (&closed_inodes);
+       e = list_next (e))
+    {
+      struct inode *inode = list_entry (e, struct inode, elem);
+      if (inode->sector == sector)
         {
-          free_map_release (inode->sector, 1); // inode_disk
-	  int i, j;
-	  for(i = 0; i < 10; i++) // direct level
-	  {
-	    if(inode->data.direct[i] == -1)
-	      goto done;
-	    free_map_release (inode->data.direct[i], 1);
-	  }
-	  struct inode_disk_level buffer1, buffer2;
-
-
-	  if(inode->data.single_level == -1) // single level
-	    goto done;
-	  block_read(fs_device, inode->data.single_level, &buffer1);
-	  for(i = 0; i < 128; i++)
-	  {
-	    if(buffer1.index[i] == -1)
-	    {
-	      free_map_release (inode->data.single_level, 1);
-	      goto done;
-	    }
-	    free_map_release (buffer1.index[i], 1);
-	  }
-	  free_map_release(inode->data.single_level, 1);
-
-
-	  if(inode->data.double_level == -1) // double level
-	    goto done;
-	  block_read(fs_device, inode->data.double_level, &buffer1);
-	  for(i = 0; i < 128; i++)
-	  {
-	    if(buffer1.index[i] == -1)
-	    {
-	      free_map_release (inode->data.double_level, 1);
-	      goto done;
-	    }
-	    block_read (fs_device, buffer1.index[i], &buffer2);
-	    for(j = 0; j < 128; j++)
-	    {
-	      if(buffer2.index[j] == -1)
-	      {
-		free_map_release (buffer1.index[i], 1);
-		free_map_release (inode->data.double_level, 1);
-		goto done;
-	      }
-	      free_map_release(buffer2.index[j], 1);
-	    }
-	    free_map_release(buffer1.index[i], 1);
-	  }
-	  free_map_release(inode->data.double_level, 1);
+          list_remove (e);
+          closed_cnt--;
+          inode_discard (inode);
+          break;
         }
-    done:
-      free (inode); 
     }
+  lockstat_release (&inode_list_lock);
+}
+
+/* Sets up INODE's in-memory fields from DISK_INODE.  Returns
+   false if memory for its inline data cannot be allocated. */
+static bool
+inode_load (struct inode *inode, const struct inode_disk *disk_inode)
+{
+  memcpy (inode->index.direct, disk_inode->direct,
+          sizeof inode->index.direct);
+  inode->index.single_level = disk_inode->single_level;
+  inode->index.double_level = disk_inode->double_level;
+  inode->index.triple_level = disk_inode->triple_level;
+  inode->length = disk_inode->length;
+  inode->flags = disk_inode->flags;
+  inode->inline_data = NULL;
+  inode->dirty = false;
+  if (inode->flags & INODE_INLINE)
+    {
+      inode->inline_data = malloc (INODE_INLINE_MAX);
+      if (inode->inline_data == NULL)
+        return false;
+      memcpy (inode->inline_data, disk_inode->inline_data, INODE_INLINE_MAX);
+    }
+  return true;
+}
+
+/* Fills in DISK_INODE from INODE's in-memory fields. */
+static void
+inode_store (const struct inode *inode, struct inode_disk *disk_inode)
+{
+  memset (disk_inode, 0, sizeof *disk_inode);
+  memcpy (disk_inode->direct, inode->index.direct,
+          sizeof disk_inode->direct);
+  disk_inode->single_level = inode->index.single_level;
+  disk_inode->double_level = inode->index.double_level;
+  disk_inode->triple_level = inode->index.triple_level;
+  disk_inode->length = inode->length;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->flags = inode->flags;
+  if (inode->inline_data != NULL)
+    memcpy (disk_inode->inline_data, inode->inline_data, INODE_INLINE_MAX);
+}
+
+/* Marks INODE's contents as file system metadata, to be written
+   through the journal. */
+void
+inode_set_journaled (struct inode *inode)
+{
+  inode->journaled = true;
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
-   has it open. */
+   has it open, and puts it on the orphan list in the running
+   transaction, if there is room. */
 void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
   inode->removed = true;
+
+  journal_begin ();
+  lockstat_acquire (&reclaim_lock);
+  orphan_add (inode->sector);
+  lockstat_release (&reclaim_lock);
+  journal_end ();
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -281,10 +984,15 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
   uint8_t *bounce = NULL;
+  struct io_batch batch;                /* Whole-sector reads. */
+
+  if (inode->flags & INODE_INLINE)
+    return inline_read (inode, buffer_, size, offset);
 
-  if(offset + size > inode->data.length)
+  io_batch_init (&batch, false);
+  if(offset + size > inode->length)
   {
-    int diff = offset + size - inode->data.length;
+    int diff = offset + size - inode->length;
     if((size = size - diff) < 0)
       return 0;
   }
@@ -308,7 +1016,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 //      memcpy(buffer + bytes_read,(uint8_t*)cache_upload(sector_idx,false) + sector_ofs, chunk_size);
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-	  block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Read whole sectors straight into the caller's
+             buffer. */
+          if (!journal_lookup (sector_idx, buffer + bytes_read)
+              && !readahead_take (inode, sector_idx, buffer + bytes_read))
+            io_batch_add (&batch, sector_idx, buffer + bytes_read);
         }
       else 
         {
@@ -318,7 +1030,9 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
               if (bounce == NULL)
                 break;
             }
-          block_read (fs_device, sector_idx, bounce);
+          if (!journal_lookup (sector_idx, bounce)
+              && !readahead_take (inode, sector_idx, bounce))
+            iosched_read (sector_idx, bounce);
           memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         } 
       
@@ -327,8 +1041,13 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
+  io_batch_finish (&batch);
   free (bounce);
 
+  /* Sequential readers will likely want the next sector. */
+  if (bytes_read > 0)
+    readahead_start (inode, ROUND_UP (offset, BLOCK_SECTOR_SIZE));
+
 //  lock_release(&inode->lock);
   return bytes_read;
 }
@@ -346,11 +1065,28 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
   uint8_t *bounce = NULL;
+  struct io_batch batch;                /* Whole-sector writes. */
+  bool filelock = false;
 
   if (inode->deny_write_cnt)
     return 0;
+  if (inode->flags & INODE_INLINE)
+    {
+      if (offset + size <= INODE_INLINE_MAX)
+        return inline_write (inode, buffer_, size, offset);
+      if (!inline_migrate (inode))
+        return 0;
+    }
+  /* file_extension() needs FILELOCK, which must be taken before
+     the journal handle. */
+  if (inode->journaled)
+    {
+      filelock = filelock_acquire ();
+      journal_begin ();
+    }
+  io_batch_init (&batch, true);
 
-  if (offset + size > inode->data.length)
+  if (offset + size > inode->length)
     file_extension(inode, size, offset);
 
   while (size > 0) 
@@ -370,39 +1106,327 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       
 //      memcpy ((uint8_t*)cache_upload(sector_idx, true) + sector_ofs, buffer + bytes_written, chunk_size);
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      readahead_cancel (inode, sector_idx);
+      if (inode->journaled)
+      {
+        /* Metadata goes through the journal. */
+        if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+          journal_write (sector_idx, buffer + bytes_written);
+        else
+        {
+          if (bounce == NULL)
+          {
+            bounce = malloc (BLOCK_SECTOR_SIZE);
+            if (bounce == NULL)
+              break;
+          }
+          journal_read (sector_idx, bounce);
+          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
+          journal_write (sector_idx, bounce);
+        }
+      }
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
       { 
-        block_write (fs_device, sector_idx, buffer+bytes_written);
+        io_batch_add (&batch, sector_idx, (uint8_t *) buffer + bytes_written);
       }
       else
       { 
         if (bounce == NULL)
         {
-          bounce == malloc (BLOCK_SECTOR_SIZE);
+          bounce = malloc (BLOCK_SECTOR_SIZE);
           if (bounce == NULL)
             break;
         }
       
 
       if (sector_ofs>0 & chunk_size < sector_left)
-        block_read (fs_device, sector_idx, bounce);
+        iosched_read (sector_idx, bounce);
       else
         memset (bounce, 0, BLOCK_SECTOR_SIZE);
  
       memcpy (bounce + sector_ofs, buffer+bytes_written, chunk_size);
-      block_write (fs_device, sector_idx, bounce);
+      iosched_write (sector_idx, bounce);
       }
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
+  io_batch_finish (&batch);
   free (bounce);
+  if (inode->journaled)
+    {
+      journal_end ();
+      filelock_release (filelock);
+    }
 
 //  lock_release(&inode->lock);
   return bytes_written;
 }
 
+/* Reads SIZE bytes at OFFSET from inline INODE into BUFFER.
+   Returns the number of bytes read. */
+static off_t
+inline_read (struct inode *inode, void *buffer, off_t size, off_t offset)
+{
+  lockstat_acquire (&inode->lock);
+  if (offset >= inode->length)
+    size = 0;
+  else if (offset + size > inode->length)
+    size = inode->length - offset;
+  if (size > 0)
+    memcpy (buffer, inode->inline_data + offset, size);
+  lockstat_release (&inode->lock);
+  return size > 0 ? size : 0;
+}
+
+/* Writes SIZE bytes from BUFFER at OFFSET into inline INODE,
+   which must have room for them.  The inode sector is written
+   back later, unless INODE is metadata, which must commit
+   together with the caller's other changes.  Returns the number
+   of bytes written. */
+static off_t
+inline_write (struct inode *inode, const void *buffer, off_t size,
+              off_t offset)
+{
+  ASSERT (offset + size <= INODE_INLINE_MAX);
+
+  if (size <= 0)
+    return 0;
+
+  lockstat_acquire (&inode->lock);
+  memcpy (inode->inline_data + offset, buffer, size);
+  if (offset + size > inode->length)
+    inode->length = offset + size;
+  inode->dirty = true;
+  lockstat_release (&inode->lock);
+  if (inode->journaled)
+    inode_flush (inode);
+  return size;
+}
+
+/* Extends inline INODE, with zeros, to LENGTH bytes, which must
+   fit inline.  Writes INODE back at once if it is metadata, as
+   inline_write() does. */
+static void
+inline_extend (struct inode *inode, off_t length)
+{
+  ASSERT (length <= INODE_INLINE_MAX);
+
+  lockstat_acquire (&inode->lock);
+  if (length > inode->length)
+    {
+      inode->length = length;
+      inode->dirty = true;
+    }
+  lockstat_release (&inode->lock);
+  if (inode->journaled)
+    inode_flush (inode);
+}
+
+/* Moves inline INODE's data out to a newly allocated data
+   sector, so that the file can grow past INODE_INLINE_MAX, and
+   writes the inode back.  Returns true if successful, false if
+   the disk is full, in which case INODE stays inline.
+
+   The data sector is written before the inode stops being
+   inline, all under INODE's lock, so readers see either the
+   inline data or the sector holding it, never an empty file. */
+static bool
+inline_migrate (struct inode *inode)
+{
+  uint8_t *inline_data = NULL, *data;
+  block_sector_t sector = (block_sector_t) -1;
+  bool filelock, success = true;
+
+  data = calloc (1, BLOCK_SECTOR_SIZE);
+  if (data == NULL)
+    return false;
+
+  filelock = filelock_acquire ();
+  journal_begin ();
+  if ((inode->flags & INODE_INLINE)
+      && inode->length > 0 && !free_map_allocate (1, &sector))
+    success = false;
+
+  lockstat_acquire (&inode->lock);
+  if (success && (inode->flags & INODE_INLINE))
+    {
+      if (sector != (block_sector_t) -1)
+        {
+          memcpy (data, inode->inline_data, inode->length);
+          if (inode->journaled)
+            journal_write (sector, data);
+          else
+            iosched_write (sector, data);
+          inode->index.direct[0] = sector;
+          sector = (block_sector_t) -1;
+        }
+      inline_data = inode->inline_data;
+      inode->inline_data = NULL;
+      inode->flags &= ~INODE_INLINE;
+      inode->dirty = true;
+    }
+  lockstat_release (&inode->lock);
+
+  /* Someone else migrated INODE while we waited. */
+  if (sector != (block_sector_t) -1)
+    free_map_release (sector, 1);
+  inode_flush (inode);
+  journal_end ();
+  filelock_release (filelock);
+  free (inline_data);
+  free (data);
+  return success;
+}
+
+/* Initializes B for a series of reads, or writes if WRITE. */
+static void
+io_batch_init (struct io_batch *b, bool write)
+{
+  b->write = write;
+  b->reqs = NULL;
+  b->req_cnt = 0;
+  b->run_cnt = 0;
+}
+
+/* Adds a transfer of SECTOR to or from BUF to B, extending the
+   current run if SECTOR and BUF directly follow it. */
+static void
+io_batch_add (struct io_batch *b, block_sector_t sector, uint8_t *buf)
+{
+  if (b->run_cnt > 0 && b->run_cnt < INODE_IO_RUN
+      && sector == b->run_sector + b->run_cnt
+      && buf == b->run_buf + b->run_cnt * BLOCK_SECTOR_SIZE)
+    {
+      b->run_cnt++;
+      return;
+    }
+
+  io_batch_flush_run (b);
+  b->run_sector = sector;
+  b->run_cnt = 1;
+  b->run_buf = buf;
+}
+
+/* Starts B's current run.  Runs into kernel memory are left in
+   flight; runs into user memory, or any run once no memory is
+   left for tracking requests, are transferred before
+   returning. */
+static void
+io_batch_flush_run (struct io_batch *b)
+{
+  if (b->run_cnt == 0)
+    return;
+
+  if (is_kernel_vaddr (b->run_buf)
+      && (b->reqs != NULL
+          || (b->reqs = malloc (INODE_IO_BATCH * sizeof *b->reqs)) != NULL))
+    {
+      if (b->req_cnt == INODE_IO_BATCH)
+        {
+          int i;
+
+          for (i = 0; i < b->req_cnt; i++)
+            iosched_wait (&b->reqs[i]);
+          b->req_cnt = 0;
+        }
+      iosched_submit (&b->reqs[b->req_cnt++], b->run_sector, b->run_cnt,
+                      b->run_buf, b->write, NULL, NULL);
+    }
+  else if (b->write)
+    iosched_write_multi (b->run_sector, b->run_cnt, b->run_buf);
+  else
+    iosched_read_multi (b->run_sector, b->run_cnt, b->run_buf);
+  b->run_cnt = 0;
+}
+
+/* Starts B's last run and waits for all of B's transfers. */
+static void
+io_batch_finish (struct io_batch *b)
+{
+  int i;
+
+  io_batch_flush_run (b);
+  for (i = 0; i < b->req_cnt; i++)
+    iosched_wait (&b->reqs[i]);
+  free (b->reqs);
+}
+
+/* If INODE has read SECTOR ahead, waits for that read, copies the
+   sector into DST, and returns true.  Otherwise returns false. */
+static bool
+readahead_take (struct inode *inode, block_sector_t sector, void *dst)
+{
+  struct readahead *ra;
+
+  lockstat_acquire (&inode->lock);
+  ra = inode->ra;
+  if (ra != NULL && ra->req.sector == sector)
+    inode->ra = NULL;
+  else
+    ra = NULL;
+  lockstat_release (&inode->lock);
+
+  if (ra == NULL)
+    return false;
+  iosched_wait (&ra->req);
+  memcpy (dst, ra->data, BLOCK_SECTOR_SIZE);
+  free (ra);
+  return true;
+}
+
+/* Drops INODE's read-ahead sector if it is SECTOR, or whatever it
+   is if SECTOR is -1, after waiting for the read to finish. */
+static void
+readahead_cancel (struct inode *inode, block_sector_t sector)
+{
+  struct readahead *ra;
+
+  lockstat_acquire (&inode->lock);
+  ra = inode->ra;
+  if (ra != NULL
+      && (sector == (block_sector_t) -1 || ra->req.sector == sector))
+    inode->ra = NULL;
+  else
+    ra = NULL;
+  lockstat_release (&inode->lock);
+
+  if (ra != NULL)
+    {
+      iosched_wait (&ra->req);
+      free (ra);
+    }
+}
+
+/* Starts reading the sector of INODE that holds byte POS, if POS
+   is within the file and no read-ahead is already pending. */
+static void
+readahead_start (struct inode *inode, off_t pos)
+{
+  struct readahead *ra;
+  block_sector_t sector;
+
+  if (pos >= inode_length (inode) || inode->ra != NULL)
+    return;
+  sector = byte_to_sector (inode, pos);
+  if (sector == (block_sector_t) -1)
+    return;
+  ra = malloc (sizeof *ra);
+  if (ra == NULL)
+    return;
+
+  lockstat_acquire (&inode->lock);
+  if (inode->ra == NULL)
+    {
+      inode->ra = ra;
+      iosched_submit (&ra->req, sector, 1, ra->data, false, NULL, NULL);
+      ra = NULL;
+    }
+  lockstat_release (&inode->lock);
+  free (ra);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
@@ -427,152 +1451,89 @@ inode_allow_write (struct inode *inode)
 off_t
 inode_length (const struct inode *inode)
 {
-  return inode->data.length;
+  return inode->length;
 }
 
-/* Extend the file with INODE.
-   1. Calculate the number of new blocks needed for extension. Get the indexes of free block
-      sectors in fs_device with free_map_allocate. Make a list of indexes.
-      If there are not enough free sectors, return false.
-   2. Fill(write) corresponding block sectors with zeroes.
-   3. Update the index information of the allocated zero-filled blocks in INODE.
- */
-
+/* Extends INODE so that it covers SIZE bytes at OFFSET.
+   Allocates a sector for each new file block with
+   free_map_allocate() and enters it in the index with
+   index_set(), which adds index blocks as needed.  If the disk
+   fills up, the file ends with the last sector obtained. */
 void file_extension(struct inode* inode_, off_t size, off_t offset)
 {
-lock_acquire (&FILELOCK);
-  // 1
-  int alloc = inode_->data.length ? (inode_->data.length - 1) / BLOCK_SECTOR_SIZE + 1 : 0;
-  int req = (offset + size - 1) / BLOCK_SECTOR_SIZE + 1;
-  off_t modified_length, add_length;
-  block_sector_t *slist = malloc(req - alloc + 1);
-  int i, j, iter = 0;
-  for(i = 0; i < req - alloc; i++)
-  {
-    if(!free_map_allocate(1, &slist[i]))
-      break;
-  }
-
-  slist[i] = -1;
-  add_length = BLOCK_SECTOR_SIZE - (inode_->data.length % BLOCK_SECTOR_SIZE) + i*BLOCK_SECTOR_SIZE;
-  modified_length = inode_->data.length + add_length; 
+  bool filelock = filelock_acquire ();
 
-  // 2
-  if(inode_->data.length % BLOCK_SECTOR_SIZE) // zero padding on the file's last block
+  /* An inline file just gets longer while it fits, and moves its
+     data out to a sector first otherwise. */
+  if (inode_->flags & INODE_INLINE)
   {
-    block_sector_t sector_idx = byte_to_sector(inode_, inode_->data.length);
-    int sector_ofs = inode_->data.length % BLOCK_SECTOR_SIZE;
-//    memset((uint8_t*)cache_upload(sector_idx, true) + sector_ofs, 0, BLOCK_SECTOR_SIZE - sector_ofs);
-  }
-//  for(i = 0; slist[i] != -1; i++) // zero padding on new blocks
-//    memset((uint8_t*)cache_upload(slist[i], true), 0, BLOCK_SECTOR_SIZE);
-
-  // 3
-  struct inode_disk *disk_inode = malloc(BLOCK_SECTOR_SIZE);
-  memcpy(disk_inode, &inode_->data, BLOCK_SECTOR_SIZE);
-  struct inode_disk_level *level1 = NULL, *level2_1 = NULL, *level2_2 = NULL;
-
-  if(slist[0] == -1) // no additional blocks obtained in extension
-    goto fin;
-
-  /* direct level */
-  for(i = 0; i < 10; i++)
-  {
-    if(disk_inode->direct[i] == -1)
+    if (offset + size <= INODE_INLINE_MAX)
     {
-      disk_inode->direct[i] = slist[iter++];
-      if(slist[iter] == -1)
-	goto fin;
+      inline_extend (inode_, offset + size);
+      filelock_release (filelock);
+      return;
     }
-  }
-
-  /* single level */
-  block_sector_t index;
-  level1 = malloc(BLOCK_SECTOR_SIZE);
-  if(disk_inode->single_level == -1)
-  {
-    free_map_allocate(1, &index);
-    disk_inode->single_level = index;
-    for(i = 0; i < 128; i++)
-      level1->index[i] = -1;
-  }
-  else
-    block_read(fs_device, disk_inode->single_level, level1);
-  
-  for(i = 0; i < 128; i++)
-  {
-    if(level1->index[i] == -1)
+    if (!inline_migrate (inode_))
     {
-      level1->index[i] = slist[iter++];
-      if(slist[iter] == -1)
-	goto fin;
+      filelock_release (filelock);
+      return;
     }
   }
 
-  /* double level */
-  level2_1 = malloc(BLOCK_SECTOR_SIZE);
-  level2_2 = malloc(BLOCK_SECTOR_SIZE);
-  if(disk_inode->double_level == -1)
-  {
-    free_map_allocate(1, &index);
-    disk_inode->double_level = index;
-    for(i = 0; i < 128; i++)
-      level2_1->index[i] = -1;
-  }
-  else
-    block_read(fs_device, disk_inode->double_level, level2_1);
+journal_begin ();
+  size_t alloc = bytes_to_sectors (inode_->length);
+  size_t req = bytes_to_sectors (offset + size);
+  struct inode_index index = inode_->index;
+  off_t max_length, length;
+  bool index_changed;
+  size_t i;
+
+  if (req > INODE_MAX_SECTORS)
+    req = INODE_MAX_SECTORS;
 
-  for(i = 0; i < 128; i++)
+  for (i = alloc; i < req; i++)
   {
-    bool written = false;
-    if(level2_1->index[i] == -1)
-    {
-      free_map_allocate(1, &index);
-      level2_1->index[i] = index;
-      for(j = 0; j < 128; j++)
-	level2_2->index[j] = -1;
-    }
-    else
-      block_read(fs_device, level2_1->index[i], level2_2);
+    block_sector_t sector;
 
-    for(j = 0; j < 128; j++)
+    /* A block past the end may already be in the index, if the
+       inode's new length never reached the disk. */
+    if (byte_to_sector (inode_, i * BLOCK_SECTOR_SIZE) != (block_sector_t) -1)
+      continue;
+    if (!free_map_allocate (1, &sector))
+      break;
+    if (!index_set (&index, i, sector))
     {
-      if(level2_2->index[j] == -1)
-      {
-	level2_2->index[j] = slist[iter++];
-	written = true;
-	if(slist[iter] == -1)
-	  goto fin;
-      }
+      free_map_release (sector, 1);
+      break;
     }
-    if(written)
-      block_write(fs_device, level2_1->index[i], level2_2);
   }
 
-fin:
-  disk_inode->length = modified_length;
-  block_write(fs_device, inode_->sector, disk_inode);
-  memcpy(&inode_->data, disk_inode, BLOCK_SECTOR_SIZE);
-  free(disk_inode);
-  if(level1 != NULL)
-  {
-    block_write(fs_device, inode_->data.single_level, level1);
-    free(level1);
-  }
-  if(level2_2 != NULL)
-  {
-    if(i == 128)
-      i--;
-    block_write(fs_device, level2_1->index[i], level2_2);
-    free(level2_2);
-  }
-  if(level2_1 != NULL)
+  /* The file now ends at OFFSET + SIZE, or at the end of the
+     last sector obtained if the disk filled up. */
+  max_length = i * BLOCK_SECTOR_SIZE;
+  length = offset + size < max_length ? offset + size : max_length;
+
+  lockstat_acquire (&inode_->lock);
+  index_changed = memcmp (&index, &inode_->index, sizeof index) != 0;
+  inode_->index = index;
+  if (length > inode_->length)
   {
-    block_write(fs_device, inode_->data.double_level, level2_1);
-    free(level2_1);
+    inode_->length = length;
+    inode_->dirty = true;
   }
-  free(slist);
-lock_release(&FILELOCK);
+  lockstat_release (&inode_->lock);
+  index_cache_drop (inode_);
+
+  /* A new pointer in the inode itself must reach the disk with
+     the index blocks and free map changes made above, and so
+     must a metadata inode's new length.  A data file's growth
+     within existing index blocks can wait. */
+  if (index_changed)
+    inode_->dirty = true;
+  if (index_changed || inode_->journaled)
+    inode_flush (inode_);
+journal_end ();
+filelock_release (filelock);
 }
 
 int
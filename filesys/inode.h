@@ -2,18 +2,59 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
+#include "filesys/warmcache.h"
 
 struct bitmap;
 
+/* Reserved sector, after the warm cache's, listing removed inodes
+   whose sectors are still to be freed. */
+#define ORPHAN_SECTOR (WARMCACHE_SECTOR + 1)
+
+/* Identifies an inode. */
+#define INODE_MAGIC 0x494e4f44
+
+/* Bytes of file data that fit in the inode itself. */
+#define INODE_INLINE_MAX 448
+
+/* Flags in struct inode_disk. */
+#define INODE_INLINE 0x1                /* Data is in inline_data. */
+
+/* On-disk inode.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file no longer than INODE_INLINE_MAX bytes keeps its data in
+   inline_data, with INODE_INLINE set and no data sectors, so it
+   costs one sector and reading it costs the inode read alone.
+   inline_data is zero beyond the file's length.  A write that
+   would take the file past INODE_INLINE_MAX first moves the data
+   out to a data sector. */
+struct inode_disk
+  {
+    block_sector_t direct[10];
+    block_sector_t single_level;
+    block_sector_t double_level;
+    off_t length;                       /* File size in bytes. */
+    unsigned magic;                     /* Magic number. */
+    uint32_t flags;                     /* INODE_* flags. */
+    block_sector_t triple_level;
+    uint8_t inline_data[INODE_INLINE_MAX]; /* Data of an inline file. */
+  };
+
 void inode_init (void);
+void inode_recover (bool format);
+void inode_done (void);
 bool inode_create (block_sector_t, off_t);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
+void inode_flush (struct inode *);
+void inode_flush_all (void);
 void inode_remove (struct inode *);
+void inode_set_journaled (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
@@ -0,0 +1,508 @@
+#include "filesys/iosched.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/warmcache.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/tsc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
+
+/* Elevator I/O scheduler for the file system device.
+
+   File system code calls iosched_read() and iosched_write(), or
+   their _multi versions for runs of consecutive sectors, instead
+   of block_read() and block_write().  Each call queues a request,
+   kept sorted by sector, and waits for it.  A dedicated "iosched"
+   thread serves the queue in C-LOOK order: it sweeps upward from
+   the last sector it served, then jumps back to the lowest
+   pending sector.  Pending requests in the same direction that
+   continue one another are taken together as one run, so the
+   device sees them back to back.
+
+   iosched_submit() queues a request without waiting, so that a
+   caller can have several requests in flight and collect them
+   later with iosched_wait(), or be told through a callback.
+
+   Until the I/O thread is running, requests go straight to the
+   device.  Reads of sectors that the warm cache (warmcache.c)
+   prefetched at boot are served from memory, and writes discard
+   its copies.
+
+   Every request is also accounted in a struct io_stats: counts,
+   how far the device had to seek, latency histograms and the
+   queue depth, so that a slow workload can be told apart as
+   seek-bound (many random requests, long service times),
+   bandwidth-bound (sequential requests, deep queue) or neither,
+   in which case it is waiting on the buffer cache.
+
+   Optionally, iosched_set_latency() makes each transfer also cost
+   a simulated amount of time computed from a simple disk model,
+   for benchmarks that must not depend on how fast the host
+   happens to serve the emulated disk. */
+
+static struct list queue;               /* Pending requests, by sector. */
+static struct lock queue_lock;          /* Protects queue and head. */
+static struct condition queue_nonempty; /* Signaled on new requests. */
+static block_sector_t head;             /* Sector after the last served. */
+static bool running;                    /* I/O thread started? */
+
+/* Bounce buffer for one sector, for when transfer() cannot
+   allocate one for the whole run. */
+static uint8_t spare_sector[BLOCK_SECTOR_SIZE];
+static struct lock spare_lock;          /* Protects spare_sector. */
+
+/* Statistics, protected by disabling interrupts. */
+static struct io_stats stats;
+static unsigned depth;                  /* Requests in flight. */
+static uint64_t init_tsc;               /* Timestamp of iosched_init(). */
+static uint64_t depth_tsc;              /* Timestamp of last depth change. */
+static block_sector_t last_end;         /* Sector after the last transfer. */
+
+/* Disk latency model, in microseconds. */
+#define TICK_US (1000000 / TIMER_FREQ)
+static bool model_enabled;              /* Charge simulated time? */
+static unsigned model_seek_us;          /* Per 1000 sectors of seek. */
+static unsigned model_rotation_us;      /* Per non-sequential request. */
+static unsigned model_transfer_us;      /* Per sector transferred. */
+static uint64_t model_debt_us;          /* Charged, not yet slept off. */
+
+static void transfer (block_sector_t, size_t cnt, void *buffer, bool write);
+static void device_transfer (struct io_request *);
+static void complete (struct io_request *);
+static void depth_change (int delta);
+static void model_charge (block_sector_t distance, size_t cnt);
+static int log2_bucket (uint64_t);
+static void iosched_thread (void *aux UNUSED);
+static bool sector_less (const struct list_elem *,
+                         const struct list_elem *, void *aux UNUSED);
+
+/* Initializes the I/O scheduler and starts its thread. */
+void
+iosched_init (void)
+{
+  list_init (&queue);
+  lock_init (&queue_lock);
+  lock_init (&spare_lock);
+  cond_init (&queue_nonempty);
+  head = 0;
+  init_tsc = depth_tsc = read_tsc ();
+  running = thread_create ("iosched", PRI_MAX, iosched_thread, NULL)
+            != TID_ERROR;
+}
+
+/* Makes every transfer take simulated time, from kernel
+   command-line option SPEC of the form "SEEK:ROT:XFER": SEEK
+   microseconds per 1000 sectors the head moves, plus ROT
+   microseconds of rotational delay for each request that does
+   not start where the previous one ended, plus XFER microseconds
+   per sector.  The cost accumulates and is slept off in whole
+   timer ticks, so it depends only on the sequence of requests. */
+void
+iosched_set_latency (const char *spec)
+{
+  const char *colon1 = strchr (spec, ':');
+  const char *colon2 = colon1 != NULL ? strchr (colon1 + 1, ':') : NULL;
+  int seek = atoi (spec);
+  int rotation = colon1 != NULL ? atoi (colon1 + 1) : -1;
+  int transfer = colon2 != NULL ? atoi (colon2 + 1) : -1;
+
+  if (seek < 0 || rotation < 0 || transfer < 0)
+    PANIC ("bad disk latency specification \"%s\"", spec);
+  model_seek_us = seek;
+  model_rotation_us = rotation;
+  model_transfer_us = transfer;
+  model_enabled = true;
+}
+
+/* Reads SECTOR from the file system device into BUFFER. */
+void
+iosched_read (block_sector_t sector, void *buffer)
+{
+  transfer (sector, 1, buffer, false);
+}
+
+/* Writes BUFFER to SECTOR on the file system device. */
+void
+iosched_write (block_sector_t sector, const void *buffer)
+{
+  transfer (sector, 1, (void *) buffer, true);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from the file
+   system device into BUFFER. */
+void
+iosched_read_multi (block_sector_t sector, size_t cnt, void *buffer)
+{
+  transfer (sector, cnt, buffer, false);
+}
+
+/* Writes CNT sectors from BUFFER to the file system device,
+   starting at SECTOR. */
+void
+iosched_write_multi (block_sector_t sector, size_t cnt, const void *buffer)
+{
+  transfer (sector, cnt, (void *) buffer, true);
+}
+
+/* Queues request R to transfer CNT sectors starting at SECTOR to
+   or from BUFFER, which must be in kernel memory, and returns
+   without waiting.  When the transfer is done, DONE_CB, if
+   non-null, is called with R and AUX from the I/O thread, or
+   from the caller if the read was served from the warm cache,
+   and then iosched_wait(R) returns.  DONE_CB must not sleep. */
+void
+iosched_submit (struct io_request *r, block_sector_t sector, size_t cnt,
+                void *buffer, bool write, io_done_func *done_cb, void *aux)
+{
+  ASSERT (cnt > 0);
+  ASSERT (is_kernel_vaddr (buffer));
+
+  if (write)
+    warmcache_invalidate (sector, cnt);
+
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->write = write;
+  r->done_cb = done_cb;
+  r->aux = aux;
+  sema_init (&r->done, 0);
+
+  /* Served from the warm cache without going to the device. */
+  if (!write && warmcache_read (sector, cnt, buffer))
+    {
+      if (done_cb != NULL)
+        done_cb (r, aux);
+      sema_up (&r->done);
+      return;
+    }
+
+  r->submit_tsc = read_tsc ();
+  depth_change (1);
+
+  if (!running)
+    {
+      device_transfer (r);
+      complete (r);
+      return;
+    }
+
+  lock_acquire (&queue_lock);
+  list_insert_ordered (&queue, &r->elem, sector_less, NULL);
+  cond_signal (&queue_nonempty, &queue_lock);
+  lock_release (&queue_lock);
+}
+
+/* Waits for request R, submitted with iosched_submit(), to
+   complete. */
+void
+iosched_wait (struct io_request *r)
+{
+  sema_down (&r->done);
+}
+
+/* Transfers CNT sectors starting at SECTOR to or from BUFFER and
+   waits for them. */
+static void
+transfer (block_sector_t sector, size_t cnt, void *buffer, bool write)
+{
+  size_t size = cnt * BLOCK_SECTOR_SIZE;
+  struct io_request r;
+  void *bounce = NULL;
+
+  /* The I/O thread cannot see our user address space. */
+  if (is_user_vaddr (buffer))
+    {
+      bounce = malloc (size);
+      if (bounce == NULL)
+        {
+          /* Short of memory: go one sector at a time through
+             spare_sector instead. */
+          uint8_t *p = buffer;
+          size_t i;
+
+          lock_acquire (&spare_lock);
+          for (i = 0; i < cnt; i++, p += BLOCK_SECTOR_SIZE)
+            {
+              if (write)
+                memcpy (spare_sector, p, BLOCK_SECTOR_SIZE);
+              iosched_submit (&r, sector + i, 1, spare_sector, write,
+                              NULL, NULL);
+              iosched_wait (&r);
+              if (!write)
+                memcpy (p, spare_sector, BLOCK_SECTOR_SIZE);
+            }
+          lock_release (&spare_lock);
+          return;
+        }
+      if (write)
+        memcpy (bounce, buffer, size);
+    }
+
+  iosched_submit (&r, sector, cnt, bounce != NULL ? bounce : buffer, write,
+                  NULL, NULL);
+  iosched_wait (&r);
+
+  if (bounce != NULL)
+    {
+      if (!write)
+        memcpy (buffer, bounce, size);
+      free (bounce);
+    }
+}
+
+/* Serves queued requests in C-LOOK order. */
+static void
+iosched_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct list run;
+      struct list_elem *e;
+      struct io_request *r;
+
+      lock_acquire (&queue_lock);
+      while (list_empty (&queue))
+        cond_wait (&queue_nonempty, &queue_lock);
+
+      /* First request at or above the head, else wrap around. */
+      for (e = list_begin (&queue); e != list_end (&queue);
+           e = list_next (e))
+        if (list_entry (e, struct io_request, elem)->sector >= head)
+          break;
+      if (e == list_end (&queue))
+        e = list_begin (&queue);
+
+      /* Take it and any requests that directly follow it. */
+      list_init (&run);
+      r = list_entry (e, struct io_request, elem);
+      for (;;)
+        {
+          struct list_elem *next = list_next (e);
+          struct io_request *n;
+
+          list_remove (e);
+          list_push_back (&run, e);
+          head = r->sector + r->cnt;
+          if (next == list_end (&queue))
+            break;
+          n = list_entry (next, struct io_request, elem);
+          if (n->sector != r->sector + r->cnt || n->write != r->write)
+            break;
+          e = next;
+          r = n;
+        }
+      lock_release (&queue_lock);
+
+      while (!list_empty (&run))
+        {
+          r = list_entry (list_pop_front (&run), struct io_request, elem);
+          device_transfer (r);
+          complete (r);
+        }
+    }
+}
+
+/* Performs the transfer described by R on the file system device.
+   The block layer moves one sector per call, so this is the one
+   place to hand a whole run to a driver that can do better. */
+static void
+device_transfer (struct io_request *r)
+{
+  uint8_t *buffer = r->buffer;
+  enum intr_level old_level;
+  block_sector_t distance;
+  uint64_t start;
+  size_t i;
+
+  old_level = intr_disable ();
+  distance = r->sector >= last_end ? r->sector - last_end
+                                   : last_end - r->sector;
+  stats.seek_sectors += distance;
+  if (distance == 0)
+    stats.sequential++;
+  else if (distance <= IOSTAT_NEAR)
+    stats.near++;
+  else
+    stats.random++;
+  last_end = r->sector + r->cnt;
+  intr_set_level (old_level);
+
+  start = read_tsc ();
+  for (i = 0; i < r->cnt; i++)
+    if (r->write)
+      block_write (fs_device, r->sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+    else
+      block_read (fs_device, r->sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+  if (model_enabled)
+    model_charge (distance, r->cnt);
+
+  old_level = intr_disable ();
+  stats.service_hist[log2_bucket (read_tsc () - start)]++;
+  if (r->write)
+    {
+      stats.writes++;
+      stats.write_sectors += r->cnt;
+    }
+  else
+    {
+      stats.reads++;
+      stats.read_sectors += r->cnt;
+    }
+  intr_set_level (old_level);
+}
+
+/* Marks R complete. */
+static void
+complete (struct io_request *r)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  stats.latency_hist[log2_bucket (read_tsc () - r->submit_tsc)]++;
+  depth_change (-1);
+  intr_set_level (old_level);
+
+  if (r->done_cb != NULL)
+    r->done_cb (r, r->aux);
+  sema_up (&r->done);
+}
+
+/* Orders requests by ascending sector. */
+static bool
+sector_less (const struct list_elem *a_, const struct list_elem *b_,
+             void *aux UNUSED)
+{
+  const struct io_request *a = list_entry (a_, struct io_request, elem);
+  const struct io_request *b = list_entry (b_, struct io_request, elem);
+
+  return a->sector < b->sector;
+}
+
+/* Copies the file system device's statistics into DST. */
+void
+iosched_get_stats (struct io_stats *dst)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  depth_change (0);
+  stats.elapsed_cycles = depth_tsc - init_tsc;
+  *dst = stats;
+  intr_set_level (old_level);
+}
+
+/* Prints the file system device's statistics. */
+void
+iosched_print_stats (void)
+{
+  struct io_stats s;
+  const char *name;
+  int i;
+
+  if (fs_device == NULL)
+    return;
+  iosched_get_stats (&s);
+  if (s.reads + s.writes == 0)
+    return;
+
+  name = block_name (fs_device);
+  printf ("Block %s: %"PRIu64" reads (%"PRIu64" sectors), "
+          "%"PRIu64" writes (%"PRIu64" sectors)\n",
+          name, s.reads, s.read_sectors, s.writes, s.write_sectors);
+  printf ("Block %s: %"PRIu64" sequential, %"PRIu64" near, "
+          "%"PRIu64" random requests, %"PRIu64" sectors seeked\n",
+          name, s.sequential, s.near, s.random, s.seek_sectors);
+  if (s.elapsed_cycles > 0)
+    printf ("Block %s: queue depth %"PRIu64".%02"PRIu64" average, %u max, "
+            "busy %"PRIu64"%%\n", name,
+            s.depth_cycles / s.elapsed_cycles,
+            s.depth_cycles % s.elapsed_cycles * 100 / s.elapsed_cycles,
+            s.max_depth, s.busy_cycles * 100 / s.elapsed_cycles);
+  if (model_enabled)
+    printf ("Block %s: %"PRIu64" ticks of simulated disk time\n",
+            name, s.model_ticks);
+  printf ("Block %s: cycles     service     latency\n", name);
+  for (i = 0; i < IOSTAT_LAT_BUCKETS; i++)
+    if (s.service_hist[i] != 0 || s.latency_hist[i] != 0)
+      printf ("Block %s: >= 2^%-2d %11"PRIu64" %11"PRIu64"\n",
+              name, i, s.service_hist[i], s.latency_hist[i]);
+  printf ("Block %s: depth   arrivals\n", name);
+  for (i = 0; i < IOSTAT_DEPTH_BUCKETS; i++)
+    if (s.depth_hist[i] != 0)
+      printf ("Block %s: %3d%s %11"PRIu64"\n", name, i,
+              i == IOSTAT_DEPTH_BUCKETS - 1 ? "+" : " ", s.depth_hist[i]);
+}
+
+/* Charges the latency model's cost for transferring CNT sectors
+   DISTANCE sectors from where the previous transfer ended, and
+   sleeps for the whole ticks owed. */
+static void
+model_charge (block_sector_t distance, size_t cnt)
+{
+  enum intr_level old_level;
+  uint64_t cost;
+  int64_t ticks;
+
+  cost = (uint64_t) cnt * model_transfer_us;
+  if (distance != 0)
+    cost += (uint64_t) distance * model_seek_us / 1000 + model_rotation_us;
+
+  old_level = intr_disable ();
+  model_debt_us += cost;
+  ticks = model_debt_us / TICK_US;
+  model_debt_us %= TICK_US;
+  stats.model_ticks += ticks;
+  intr_set_level (old_level);
+
+  if (ticks > 0)
+    timer_sleep (ticks);
+}
+
+/* Adds DELTA to the number of requests in flight, first charging
+   the time since the last change to the old depth.  A positive
+   DELTA records an arrival in the depth histogram. */
+static void
+depth_change (int delta)
+{
+  enum intr_level old_level;
+  uint64_t now;
+
+  old_level = intr_disable ();
+  now = read_tsc ();
+  stats.depth_cycles += depth * (now - depth_tsc);
+  if (depth > 0)
+    stats.busy_cycles += now - depth_tsc;
+  depth_tsc = now;
+
+  if (delta > 0)
+    stats.depth_hist[depth < IOSTAT_DEPTH_BUCKETS
+                     ? depth : IOSTAT_DEPTH_BUCKETS - 1]++;
+  depth += delta;
+  if (depth > stats.max_depth)
+    stats.max_depth = depth;
+  intr_set_level (old_level);
+}
+
+/* Returns the latency histogram bucket for CYCLES. */
+static int
+log2_bucket (uint64_t cycles)
+{
+  int bucket = 0;
+
+  while (cycles > 1 && bucket < IOSTAT_LAT_BUCKETS - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
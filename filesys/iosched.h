@@ -0,0 +1,89 @@
+#ifndef FILESYS_IOSCHED_H
+#define FILESYS_IOSCHED_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+
+struct io_request;
+
+/* Called by the I/O thread when request R completes. */
+typedef void io_done_func (struct io_request *r, void *aux);
+
+/* An asynchronous transfer of a run of consecutive sectors.  The
+   submitter owns the request and its buffer until iosched_wait()
+   returns. */
+struct io_request
+  {
+    struct list_elem elem;      /* Element in queue. */
+    block_sector_t sector;      /* First sector to transfer. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* Kernel buffer, CNT sectors long. */
+    bool write;                 /* Write if true, read if false. */
+    io_done_func *done_cb;      /* Completion callback, or null. */
+    void *aux;                  /* Passed to done_cb. */
+    struct semaphore done;      /* Upped when the transfer is done. */
+    uint64_t submit_tsc;        /* Timestamp when submitted. */
+  };
+
+/* Number of buckets in each latency histogram.  Bucket I counts
+   requests that took from 2**I up to 2**(I+1) CPU cycles. */
+#define IOSTAT_LAT_BUCKETS 32
+
+/* Number of buckets in the queue depth histogram.  The last
+   bucket also counts all greater depths. */
+#define IOSTAT_DEPTH_BUCKETS 16
+
+/* Requests that start within this many sectors of where the
+   previous one ended count as near, not random. */
+#define IOSTAT_NEAR 64
+
+/* Statistics for the file system device. */
+struct io_stats
+  {
+    uint64_t reads;                     /* Read requests completed. */
+    uint64_t writes;                    /* Write requests completed. */
+    uint64_t read_sectors;              /* Sectors read. */
+    uint64_t write_sectors;             /* Sectors written. */
+
+    /* Requests by distance from the end of the previous one. */
+    uint64_t sequential;                /* Distance 0. */
+    uint64_t near;                      /* Up to IOSTAT_NEAR sectors. */
+    uint64_t random;                    /* Farther. */
+    uint64_t seek_sectors;              /* Sum of all distances. */
+
+    /* Time at the device, and from submission to completion. */
+    uint64_t service_hist[IOSTAT_LAT_BUCKETS];
+    uint64_t latency_hist[IOSTAT_LAT_BUCKETS];
+
+    /* Requests in flight, as seen by each arriving request. */
+    uint64_t depth_hist[IOSTAT_DEPTH_BUCKETS];
+    unsigned max_depth;                 /* Most requests ever in flight. */
+
+    /* Queue depth over time, in CPU cycles. */
+    uint64_t elapsed_cycles;            /* Since iosched_init(). */
+    uint64_t busy_cycles;               /* With a request in flight. */
+    uint64_t depth_cycles;              /* Depth integrated over time. */
+
+    /* Simulated disk time charged by iosched_set_latency(). */
+    uint64_t model_ticks;
+  };
+
+void iosched_init (void);
+void iosched_set_latency (const char *spec);
+void iosched_read (block_sector_t, void *);
+void iosched_write (block_sector_t, const void *);
+void iosched_read_multi (block_sector_t, size_t cnt, void *);
+void iosched_write_multi (block_sector_t, size_t cnt, const void *);
+
+void iosched_submit (struct io_request *, block_sector_t, size_t cnt,
+                     void *buffer, bool write, io_done_func *, void *aux);
+void iosched_wait (struct io_request *);
+
+void iosched_get_stats (struct io_stats *);
+void iosched_print_stats (void);
+
+#endif /* filesys/iosched.h */
@@ -0,0 +1,823 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/free-map.h"
+#include "filesys/iosched.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Inodes, index blocks, directory contents and the free map are
+   not written to their home sectors directly.  Code that changes
+   them brackets the change with journal_begin() and
+   journal_end() and hands each changed sector to
+   journal_write(), which copies it into the running transaction.
+   A sector written again before the transaction commits just
+   replaces its copy.  File data is written in place as before.
+
+   The "journal" thread commits the running transaction once it
+   holds JOURNAL_TXN_BLOCKS sectors or is JOURNAL_COMMIT_TICKS
+   old, so that the updates of many operations go to disk
+   together, as one sequential append to the log: a descriptor
+   naming the home sectors, the sectors themselves, and finally
+   a commit record.  A transaction counts only if its commit
+   record made it to disk.
+
+   Committed sectors are kept in memory and written to their
+   home locations only when the log fills up (a "checkpoint"),
+   after which the log starts over.  Until then, journal_read()
+   and journal_lookup() return the journal's copy of a sector in
+   preference to the one on disk.  At boot, journal_init()
+   replays every committed transaction still in the log.
+
+   A metadata sector that is freed while the log may still hold
+   a copy of it is not handed back to the free map until that
+   copy is gone, since replaying it over the sector's next user
+   would corrupt it. */
+
+/* Magic numbers. */
+#define JOURNAL_MAGIC 0x4a524e4c        /* Journal header. */
+#define DESC_MAGIC 0x4a444553           /* Descriptor record. */
+#define COMMIT_MAGIC 0x4a434d54         /* Commit record. */
+
+/* The log, following the header. */
+#define LOG_START (JOURNAL_SECTOR + 1)
+#define LOG_END (JOURNAL_SECTOR + JOURNAL_SECTORS)
+
+/* Number of home sectors a descriptor can name. */
+#define DESC_CNT 125
+
+/* A transaction is committed once it holds this many sectors... */
+#define JOURNAL_TXN_BLOCKS 32
+
+/* ...or its first sector is this many ticks old. */
+#define JOURNAL_COMMIT_TICKS (5 * TIMER_FREQ)
+
+/* How often the journal thread checks. */
+#define JOURNAL_POLL_TICKS (TIMER_FREQ / 10)
+
+/* Number of buckets in each table of sectors. */
+#define JOURNAL_HASH_SIZE 64
+
+/* Journal header, in sector JOURNAL_SECTOR. */
+struct journal_header
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t seq;                       /* First transaction in log. */
+    uint32_t unused[126];               /* Not used. */
+  };
+
+/* Descriptor or commit record in the log. */
+struct journal_record
+  {
+    unsigned magic;                     /* DESC_MAGIC or COMMIT_MAGIC. */
+    uint32_t seq;                       /* Transaction sequence number. */
+    uint32_t cnt;                       /* Number of sectors logged. */
+    block_sector_t sectors[DESC_CNT];   /* Their home sectors. */
+  };
+
+/* A metadata sector held by the journal. */
+struct jblock
+  {
+    struct list_elem elem;              /* Element in jtable bucket. */
+    block_sector_t sector;              /* Home sector. */
+    struct io_request req;              /* For writing it out. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Contents. */
+  };
+
+/* Sectors hashed by sector number. */
+struct jtable
+  {
+    struct list buckets[JOURNAL_HASH_SIZE];
+    size_t cnt;                         /* Number of sectors. */
+  };
+
+/* A transaction. */
+struct txn
+  {
+    uint32_t seq;                       /* Sequence number. */
+    struct jtable blocks;               /* Sectors written. */
+    int handles;                        /* Threads inside the txn. */
+    bool locked;                        /* Committing, closed to joiners. */
+    int64_t start;                      /* Tick of first write. */
+  };
+
+/* A freed sector waiting to be returned to the free map. */
+struct deferred_free
+  {
+    struct list_elem elem;              /* Element in deferred. */
+    block_sector_t sector;              /* Freed sector. */
+    uint32_t seq;                       /* Transaction that freed it. */
+  };
+
+/* Protects the transactions, the checkpoint table and the
+   deferred list. */
+static struct lock journal_lock;
+static struct condition handles_done;   /* Running txn has no handles. */
+static struct condition txn_open;       /* Running txn not locked. */
+
+static struct txn txns[2];
+static struct txn *running;             /* Accepting writes. */
+static struct txn *committing;          /* Being written, or null. */
+static struct jtable checkpoint;        /* Committed, not yet home. */
+static struct list deferred;            /* Freed sectors held back. */
+static struct slab_cache jblock_cache;
+
+/* Serializes commits and checkpoints, and protects the members
+   below. */
+static struct lock commit_lock;
+static block_sector_t log_next;         /* Next free sector in log. */
+static uint32_t log_seq;                /* Sequence number in header. */
+static struct journal_header header;
+static struct journal_record desc, commit;
+static uint8_t replay_buffer[BLOCK_SECTOR_SIZE];
+
+/* Statistics. */
+static unsigned commit_cnt;             /* Transactions committed. */
+static unsigned logged_cnt;             /* Sectors written to the log. */
+static unsigned checkpoint_cnt;         /* Checkpoints. */
+static unsigned home_cnt;               /* Sectors written home. */
+static unsigned replay_cnt;             /* Transactions replayed. */
+
+static void journal_thread (void *aux UNUSED);
+static void replay (void);
+static uint32_t replay_log (bool apply);
+static void write_header (void);
+static void write_txn (struct txn *);
+static void write_home (struct jtable *);
+static void do_checkpoint (uint32_t next_seq);
+static void flush (void);
+static void collect_releasable (struct list *);
+static void release_deferred (struct list *);
+
+static void jtable_init (struct jtable *);
+static struct list *jtable_bucket (struct jtable *, block_sector_t);
+static struct jblock *jtable_find (struct jtable *, block_sector_t);
+static void jtable_insert (struct jtable *, struct jblock *);
+static void jtable_clear (struct jtable *);
+static struct jblock *find_block (block_sector_t);
+
+/* Initializes the journal.  If FORMAT is true, creates an empty
+   journal; otherwise replays the one on disk. */
+void
+journal_init (bool format)
+{
+  lock_init (&journal_lock);
+  cond_init (&handles_done);
+  cond_init (&txn_open);
+  lock_init (&commit_lock);
+  slab_cache_init (&jblock_cache, "jblock", sizeof (struct jblock), NULL);
+  jtable_init (&txns[0].blocks);
+  jtable_init (&txns[1].blocks);
+  jtable_init (&checkpoint);
+  list_init (&deferred);
+
+  if (format)
+    {
+      log_seq = 1;
+      write_header ();
+    }
+  else
+    replay ();
+
+  log_next = LOG_START;
+  running = &txns[0];
+  running->seq = log_seq;
+  running->handles = 0;
+  running->locked = false;
+  committing = NULL;
+  thread_create ("journal", PRI_DEFAULT, journal_thread, NULL);
+}
+
+/* Commits all outstanding transactions and writes everything
+   home, leaving an empty log. */
+void
+journal_done (void)
+{
+  /* Sectors released by the first pass dirty the free map. */
+  flush ();
+  flush ();
+}
+
+/* Starts or joins the running transaction.  Calls nest; the
+   transaction cannot commit until the outermost journal_end().
+   While the running transaction waits to commit, new callers
+   wait for the next one instead of holding the commit up. */
+void
+journal_begin (void)
+{
+  if (thread_current ()->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (running->locked)
+    cond_wait (&txn_open, &journal_lock);
+  running->handles++;
+  lock_release (&journal_lock);
+}
+
+/* Leaves the running transaction. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--running->handles == 0)
+    cond_broadcast (&handles_done, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Logs BUFFER as the new contents of metadata SECTOR in the
+   running transaction.  Must be called between journal_begin()
+   and journal_end().  If memory is short, waits until there is
+   enough. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  struct jblock *b;
+
+  ASSERT (thread_current ()->journal_depth > 0);
+
+  lock_acquire (&journal_lock);
+  while ((b = jtable_find (&running->blocks, sector)) == NULL)
+    {
+      b = slab_alloc (&jblock_cache);
+      if (b != NULL)
+        {
+          b->sector = sector;
+          if (running->blocks.cnt == 0)
+            running->start = timer_ticks ();
+          jtable_insert (&running->blocks, b);
+          break;
+        }
+
+      /* Writing the committed sectors home frees their copies,
+         unless a commit is under way; either way, give others a
+         chance to free memory before trying again. */
+      lock_release (&journal_lock);
+      if (lock_try_acquire (&commit_lock))
+        {
+          if (checkpoint.cnt > 0)
+            do_checkpoint (running->seq);
+          lock_release (&commit_lock);
+        }
+      timer_sleep (1);
+      lock_acquire (&journal_lock);
+    }
+  memcpy (b->data, buffer, BLOCK_SECTOR_SIZE);
+  lock_release (&journal_lock);
+}
+
+/* Reads metadata SECTOR into BUFFER, from the journal if it
+   holds the sector, otherwise from disk. */
+void
+journal_read (block_sector_t sector, void *buffer)
+{
+  if (!journal_lookup (sector, buffer))
+    iosched_read (sector, buffer);
+}
+
+/* If the journal holds a copy of SECTOR newer than the one on
+   disk, copies it into BUFFER and returns true.  Otherwise
+   returns false. */
+bool
+journal_lookup (block_sector_t sector, void *buffer)
+{
+  struct jblock *b;
+
+  lock_acquire (&journal_lock);
+  b = find_block (sector);
+  if (b != NULL)
+    memcpy (buffer, b->data, BLOCK_SECTOR_SIZE);
+  lock_release (&journal_lock);
+
+  return b != NULL;
+}
+
+/* Called by the free map when SECTOR is freed.  If the log may
+   hold a copy of SECTOR, returns true: the journal takes over the
+   sector and releases it once the copy is gone.  Otherwise
+   returns false, and SECTOR may be reused at once. */
+bool
+journal_defer_release (block_sector_t sector)
+{
+  struct deferred_free *d;
+  bool held;
+
+  lock_acquire (&journal_lock);
+  held = find_block (sector) != NULL;
+  if (held)
+    {
+      /* Without memory to remember it, the sector is leaked,
+         which is safe. */
+      d = malloc (sizeof *d);
+      if (d != NULL)
+        {
+          d->sector = sector;
+          d->seq = running->seq;
+          list_push_back (&deferred, &d->elem);
+        }
+    }
+  lock_release (&journal_lock);
+
+  return held;
+}
+
+/* Commits the running transaction, if it has any sectors, after
+   waiting for all threads inside it to leave.  Must not be
+   called inside a transaction. */
+void
+journal_commit (void)
+{
+  struct txn *t;
+  size_t need;
+  struct list release;
+
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&commit_lock);
+  lock_acquire (&journal_lock);
+  if (running->blocks.cnt == 0)
+    {
+      lock_release (&journal_lock);
+      lock_release (&commit_lock);
+      return;
+    }
+  running->locked = true;
+  while (running->handles > 0)
+    cond_wait (&handles_done, &journal_lock);
+  t = committing = running;
+  running = running == &txns[0] ? &txns[1] : &txns[0];
+  running->seq = t->seq + 1;
+  running->handles = 0;
+  running->locked = false;
+  t->locked = false;
+  cond_broadcast (&txn_open, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* Descriptor, sectors, commit record.  A transaction too big
+     for one descriptor also needs the older copies of its
+     sectors out of the way first. */
+  need = t->blocks.cnt + 2;
+  if (t->blocks.cnt > DESC_CNT || log_next + need > LOG_END)
+    do_checkpoint (t->seq);
+
+  list_init (&release);
+  if (t->blocks.cnt <= DESC_CNT)
+    {
+      size_t i;
+
+      write_txn (t);
+
+      /* Committed sectors replace older copies awaiting
+         checkpoint. */
+      lock_acquire (&journal_lock);
+      for (i = 0; i < JOURNAL_HASH_SIZE; i++)
+        while (!list_empty (&t->blocks.buckets[i]))
+          {
+            struct jblock *b = list_entry (list_pop_front
+                                           (&t->blocks.buckets[i]),
+                                           struct jblock, elem);
+            struct jblock *old = jtable_find (&checkpoint, b->sector);
+
+            if (old != NULL)
+              {
+                list_remove (&old->elem);
+                checkpoint.cnt--;
+                slab_free (&jblock_cache, old);
+              }
+            jtable_insert (&checkpoint, b);
+          }
+      t->blocks.cnt = 0;
+    }
+  else
+    {
+      /* Too big for the log, which do_checkpoint() just emptied.
+         Write it straight home, then start the log at the next
+         transaction so that replay does not stop at the gap;
+         this one transaction is not atomic. */
+      write_home (&t->blocks);
+      log_seq = t->seq + 1;
+      write_header ();
+      lock_acquire (&journal_lock);
+      jtable_clear (&t->blocks);
+    }
+  committing = NULL;
+  collect_releasable (&release);
+  lock_release (&journal_lock);
+  commit_cnt++;
+  lock_release (&commit_lock);
+
+  release_deferred (&release);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %u transactions committed, %u sectors logged, "
+          "%u replayed\n", commit_cnt, logged_cnt, replay_cnt);
+  printf ("Journal: %u checkpoints, %u sectors written home\n",
+          checkpoint_cnt, home_cnt);
+}
+
+/* Sectors in journal_selftest()'s oversized transaction. */
+#define SELFTEST_CNT (DESC_CNT + 5)
+
+/* Checks that a transaction too big for one descriptor reaches
+   disk intact and that a transaction committed after it is still
+   found by replay.  Started by kernel command-line action
+   "journal-test".  Prints one line per check. */
+void
+journal_selftest (void)
+{
+  block_sector_t *sectors = malloc (SELFTEST_CNT * sizeof *sectors);
+  uint8_t *buffer = malloc (BLOCK_SECTOR_SIZE);
+  uint8_t *disk = malloc (BLOCK_SECTOR_SIZE);
+  uint32_t small_seq, replay_seq;
+  size_t i, cnt, bad;
+
+  if (sectors == NULL || buffer == NULL || disk == NULL)
+    {
+      printf ("journal-test: out of memory\n");
+      goto done;
+    }
+
+  /* Scratch sectors to write. */
+  journal_begin ();
+  for (cnt = 0; cnt < SELFTEST_CNT; cnt++)
+    if (!free_map_allocate (1, &sectors[cnt]))
+      break;
+  journal_end ();
+  journal_commit ();
+  if (cnt < SELFTEST_CNT)
+    {
+      printf ("journal-test: disk full\n");
+      goto release;
+    }
+
+  /* One transaction bigger than a descriptor... */
+  journal_begin ();
+  for (i = 0; i < cnt; i++)
+    {
+      memset (buffer, (int) (i + 1), BLOCK_SECTOR_SIZE);
+      journal_write (sectors[i], buffer);
+    }
+  journal_end ();
+  journal_commit ();
+
+  /* ...followed by an ordinary one. */
+  journal_begin ();
+  memset (buffer, 0xff, BLOCK_SECTOR_SIZE);
+  journal_write (sectors[0], buffer);
+  lock_acquire (&journal_lock);
+  small_seq = running->seq;
+  lock_release (&journal_lock);
+  journal_end ();
+  journal_commit ();
+
+  /* Every sector must read back, through the journal and, for
+     those not rewritten since, from disk. */
+  bad = 0;
+  for (i = 0; i < cnt; i++)
+    {
+      int byte = i == 0 ? 0xff : (uint8_t) (i + 1);
+
+      journal_read (sectors[i], buffer);
+      if (buffer[0] != byte || buffer[BLOCK_SECTOR_SIZE - 1] != byte)
+        bad++;
+      else if (i > 0)
+        {
+          iosched_read (sectors[i], disk);
+          if (memcmp (buffer, disk, BLOCK_SECTOR_SIZE))
+            bad++;
+        }
+    }
+  printf ("journal-test: read back %zu sectors: %s\n",
+          cnt, bad == 0 ? "PASS" : "FAIL");
+
+  lock_acquire (&commit_lock);
+  replay_seq = replay_log (false);
+  lock_release (&commit_lock);
+  printf ("journal-test: replay reaches transaction %"PRIu32": %s\n",
+          small_seq, replay_seq > small_seq ? "PASS" : "FAIL");
+
+ release:
+  journal_begin ();
+  for (i = 0; i < cnt; i++)
+    free_map_release (sectors[i], 1);
+  journal_end ();
+ done:
+  free (disk);
+  free (buffer);
+  free (sectors);
+}
+
+/* Commits the running transaction when it is big or old
+   enough. */
+static void
+journal_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      bool due;
+
+      timer_sleep (JOURNAL_POLL_TICKS);
+      lock_acquire (&journal_lock);
+      due = running->blocks.cnt >= JOURNAL_TXN_BLOCKS
+            || (running->blocks.cnt > 0
+                && timer_elapsed (running->start) >= JOURNAL_COMMIT_TICKS);
+      lock_release (&journal_lock);
+      if (due)
+        journal_commit ();
+    }
+}
+
+/* Replays the committed transactions in the log and empties
+   it. */
+static void
+replay (void)
+{
+  log_seq = replay_log (true);
+  if (replay_cnt > 0)
+    printf ("journal: replayed %u transactions\n", replay_cnt);
+  write_header ();
+}
+
+/* Reads the log from disk and returns the sequence number
+   following the last committed transaction in it.  If APPLY is
+   true, also writes those transactions' sectors home.  Uses the
+   static commit record and buffer, so only one thread may run it
+   at a time, not concurrently with a commit. */
+static uint32_t
+replay_log (bool apply)
+{
+  struct journal_record *rec = &commit;
+  uint8_t *buffer = replay_buffer;
+  block_sector_t pos = LOG_START;
+  uint32_t seq;
+
+  iosched_read (JOURNAL_SECTOR, &header);
+  if (header.magic != JOURNAL_MAGIC)
+    PANIC ("journal: bad header, file system needs formatting");
+
+  for (seq = header.seq; ; seq++)
+    {
+      uint32_t i, cnt;
+
+      iosched_read (pos, rec);
+      if (rec->magic != DESC_MAGIC || rec->seq != seq
+          || rec->cnt > DESC_CNT || pos + rec->cnt + 2 > LOG_END)
+        break;
+      cnt = rec->cnt;
+      memcpy (&desc, rec, sizeof desc);
+
+      iosched_read (pos + cnt + 1, rec);
+      if (rec->magic != COMMIT_MAGIC || rec->seq != seq || rec->cnt != cnt)
+        break;
+
+      if (apply)
+        {
+          for (i = 0; i < cnt; i++)
+            {
+              iosched_read (pos + 1 + i, buffer);
+              iosched_write (desc.sectors[i], buffer);
+            }
+          replay_cnt++;
+        }
+      pos += cnt + 2;
+    }
+  return seq;
+}
+
+/* Writes the journal header, marking the log empty. */
+static void
+write_header (void)
+{
+  memset (&header, 0, sizeof header);
+  header.magic = JOURNAL_MAGIC;
+  header.seq = log_seq;
+  iosched_write (JOURNAL_SECTOR, &header);
+}
+
+/* Appends transaction T to the log.  T's descriptor and sectors
+   go out together, and the commit record only once they are on
+   disk. */
+static void
+write_txn (struct txn *t)
+{
+  struct io_request desc_req;
+  struct list_elem *e;
+  block_sector_t pos = log_next + 1;
+  size_t i;
+
+  desc.magic = DESC_MAGIC;
+  desc.seq = t->seq;
+  desc.cnt = t->blocks.cnt;
+  for (i = 0; i < JOURNAL_HASH_SIZE; i++)
+    for (e = list_begin (&t->blocks.buckets[i]);
+         e != list_end (&t->blocks.buckets[i]); e = list_next (e))
+      {
+        struct jblock *b = list_entry (e, struct jblock, elem);
+        desc.sectors[pos - log_next - 1] = b->sector;
+        iosched_submit (&b->req, pos++, 1, b->data, true, NULL, NULL);
+      }
+  iosched_submit (&desc_req, log_next, 1, &desc, true, NULL, NULL);
+
+  iosched_wait (&desc_req);
+  for (i = 0; i < JOURNAL_HASH_SIZE; i++)
+    for (e = list_begin (&t->blocks.buckets[i]);
+         e != list_end (&t->blocks.buckets[i]); e = list_next (e))
+      iosched_wait (&list_entry (e, struct jblock, elem)->req);
+
+  memset (&commit, 0, sizeof commit);
+  commit.magic = COMMIT_MAGIC;
+  commit.seq = t->seq;
+  commit.cnt = t->blocks.cnt;
+  iosched_write (pos, &commit);
+
+  log_next = pos + 1;
+  logged_cnt += t->blocks.cnt;
+}
+
+/* Writes every sector in TABLE to its home location. */
+static void
+write_home (struct jtable *table)
+{
+  struct list_elem *e;
+  size_t i;
+
+  for (i = 0; i < JOURNAL_HASH_SIZE; i++)
+    for (e = list_begin (&table->buckets[i]);
+         e != list_end (&table->buckets[i]); e = list_next (e))
+      {
+        struct jblock *b = list_entry (e, struct jblock, elem);
+        iosched_submit (&b->req, b->sector, 1, b->data, true, NULL, NULL);
+      }
+  for (i = 0; i < JOURNAL_HASH_SIZE; i++)
+    for (e = list_begin (&table->buckets[i]);
+         e != list_end (&table->buckets[i]); e = list_next (e))
+      iosched_wait (&list_entry (e, struct jblock, elem)->req);
+  home_cnt += table->cnt;
+}
+
+/* Writes all committed sectors home and empties the log, so that
+   the next transaction to be written, NEXT_SEQ, starts it.
+   commit_lock must be held. */
+static void
+do_checkpoint (uint32_t next_seq)
+{
+  ASSERT (lock_held_by_current_thread (&commit_lock));
+
+  write_home (&checkpoint);
+  log_seq = next_seq;
+  write_header ();
+  log_next = LOG_START;
+  checkpoint_cnt++;
+
+  lock_acquire (&journal_lock);
+  jtable_clear (&checkpoint);
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction, then checkpoints and releases
+   deferred sectors. */
+static void
+flush (void)
+{
+  struct list release;
+
+  journal_commit ();
+
+  list_init (&release);
+  lock_acquire (&commit_lock);
+  do_checkpoint (running->seq);
+  lock_acquire (&journal_lock);
+  collect_releasable (&release);
+  lock_release (&journal_lock);
+  lock_release (&commit_lock);
+
+  release_deferred (&release);
+}
+
+/* Moves the deferred sectors whose freeing has been committed and
+   which the log no longer holds into RELEASE.  journal_lock must
+   be held. */
+static void
+collect_releasable (struct list *release)
+{
+  struct list_elem *e, *next;
+
+  for (e = list_begin (&deferred); e != list_end (&deferred); e = next)
+    {
+      struct deferred_free *d = list_entry (e, struct deferred_free, elem);
+
+      next = list_next (e);
+      if (d->seq < log_seq)
+        {
+          list_remove (e);
+          list_push_back (release, e);
+        }
+    }
+}
+
+/* Returns the sectors in RELEASE to the free map. */
+static void
+release_deferred (struct list *release)
+{
+  if (list_empty (release))
+    return;
+
+  journal_begin ();
+  while (!list_empty (release))
+    {
+      struct deferred_free *d = list_entry (list_pop_front (release),
+                                            struct deferred_free, elem);
+      free_map_release (d->sector, 1);
+      free (d);
+    }
+  journal_end ();
+}
+
+/* Initializes TABLE as empty. */
+static void
+jtable_init (struct jtable *table)
+{
+  size_t i;
+
+  for (i = 0; i < JOURNAL_HASH_SIZE; i++)
+    list_init (&table->buckets[i]);
+  table->cnt = 0;
+}
+
+/* Returns the bucket in TABLE for SECTOR. */
+static struct list *
+jtable_bucket (struct jtable *table, block_sector_t sector)
+{
+  return &table->buckets[sector % JOURNAL_HASH_SIZE];
+}
+
+/* Returns TABLE's copy of SECTOR, or a null pointer. */
+static struct jblock *
+jtable_find (struct jtable *table, block_sector_t sector)
+{
+  struct list *bucket = jtable_bucket (table, sector);
+  struct list_elem *e;
+
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+    {
+      struct jblock *b = list_entry (e, struct jblock, elem);
+      if (b->sector == sector)
+        return b;
+    }
+  return NULL;
+}
+
+/* Adds B to TABLE, which must not already hold its sector. */
+static void
+jtable_insert (struct jtable *table, struct jblock *b)
+{
+  list_push_back (jtable_bucket (table, b->sector), &b->elem);
+  table->cnt++;
+}
+
+/* Frees every sector in TABLE. */
+static void
+jtable_clear (struct jtable *table)
+{
+  size_t i;
+
+  for (i = 0; i < JOURNAL_HASH_SIZE; i++)
+    while (!list_empty (&table->buckets[i]))
+      slab_free (&jblock_cache,
+                 list_entry (list_pop_front (&table->buckets[i]),
+                             struct jblock, elem));
+  table->cnt = 0;
+}
+
+/* Returns the journal's newest copy of SECTOR, or a null
+   pointer.  journal_lock must be held. */
+static struct jblock *
+find_block (block_sector_t sector)
+{
+  struct jblock *b = jtable_find (&running->blocks, sector);
+
+  if (b == NULL && committing != NULL)
+    b = jtable_find (&committing->blocks, sector);
+  if (b == NULL)
+    b = jtable_find (&checkpoint, sector);
+  return b;
+}
@@ -0,0 +1,25 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* On-disk journal: a header sector followed by the log. */
+#define JOURNAL_SECTOR 2        /* Journal header sector. */
+#define JOURNAL_SECTORS 128     /* Header plus log, in sectors. */
+
+void journal_init (bool format);
+void journal_done (void);
+
+void journal_begin (void);
+void journal_end (void);
+void journal_write (block_sector_t, const void *);
+void journal_read (block_sector_t, void *);
+bool journal_lookup (block_sector_t, void *);
+bool journal_defer_release (block_sector_t);
+
+void journal_commit (void);
+void journal_print_stats (void);
+void journal_selftest (void);
+
+#endif /* filesys/journal.h */
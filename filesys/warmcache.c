@@ -0,0 +1,384 @@
+#include "filesys/warmcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/iosched.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Warm cache: carries the set of hot sectors across reboots.
+
+   While the file system is up, every sector read is counted.
+   filesys_done() calls warmcache_done(), which writes the most
+   often read sectors, in ascending order, to WARMCACHE_SECTOR.
+   At the next boot warmcache_init() reads that list back and
+   queues reads for all of those sectors at once, merging runs of
+   consecutive sectors into single requests, so that the I/O
+   thread fetches the whole set in one sweep across the disk
+   while the system starts up.
+
+   Reads submitted to the I/O scheduler are satisfied from the
+   prefetched copies when possible, without touching the device.
+   A write to a sector discards its copy for good, even if the
+   prefetch is still in flight.  The list is only a hint: a
+   missing or damaged list just means a cold start. */
+
+/* Magic number for the sector list. */
+#define WARM_MAGIC 0x5741524d           /* "WARM". */
+
+/* Most sectors listed, which is as many as fit in one sector. */
+#define WARM_MAX 126
+
+/* Longest run of sectors read by one prefetch request. */
+#define WARM_RUN 32
+
+/* Slots in the table of read counts.  Once it is 3/4 full,
+   sectors not already in it are no longer counted. */
+#define WARM_TRACK 1024
+
+/* List of sectors, in sector WARMCACHE_SECTOR. */
+struct warm_disk
+  {
+    unsigned magic;                     /* WARM_MAGIC. */
+    uint32_t cnt;                       /* Number of sectors listed. */
+    block_sector_t sectors[WARM_MAX];   /* Sectors, ascending. */
+  };
+
+/* State of a prefetched sector. */
+enum warm_state
+  {
+    WARM_PENDING,               /* Read in flight. */
+    WARM_VALID,                 /* Copy matches the disk. */
+    WARM_STALE                  /* Written since, copy unusable. */
+  };
+
+/* A prefetched sector.  Its data is at the same index in pool. */
+struct warm_entry
+  {
+    block_sector_t sector;
+    enum warm_state state;
+  };
+
+/* Read count for one sector. */
+struct warm_count
+  {
+    block_sector_t sector;
+    uint32_t cnt;                       /* 0 if slot is empty. */
+  };
+
+/* Prefetched sectors, ascending, and their data. */
+static struct warm_entry *entries;
+static size_t entry_cnt;
+static uint8_t *pool;
+static size_t pool_pages;
+
+/* Prefetch requests. */
+static struct io_request *reqs;
+static size_t req_cnt;
+
+/* Read counts, hashed by sector. */
+static struct warm_count *counts;
+static size_t count_used;
+
+/* True while our own reads are being submitted, and after
+   warmcache_done(): reads are neither counted nor served. */
+static bool quiet = true;
+
+/* Statistics. */
+static unsigned long long hit_cnt;      /* Sectors served. */
+static unsigned long long stale_cnt;    /* Copies discarded. */
+static size_t saved_cnt;                /* Sectors listed at shutdown. */
+
+static void prefetch_done (struct io_request *, void *aux);
+static struct warm_entry *find_entry (block_sector_t);
+static void count_read (block_sector_t);
+static int count_more (const void *, const void *);
+static int sector_less (const void *, const void *);
+
+/* Initializes the warm cache and starts prefetching the sectors
+   listed at the last shutdown.  If FORMAT is true, the file
+   system is new, so the list is cleared instead. */
+void
+warmcache_init (bool format)
+{
+  struct warm_disk *d;
+  size_t i;
+
+  counts = calloc (WARM_TRACK, sizeof *counts);
+  d = malloc (sizeof *d);
+  if (counts == NULL || d == NULL)
+    PANIC ("warmcache: out of memory");
+
+  if (format)
+    {
+      memset (d, 0, sizeof *d);
+      d->magic = WARM_MAGIC;
+      iosched_write (WARMCACHE_SECTOR, d);
+      free (d);
+      quiet = false;
+      return;
+    }
+
+  iosched_read (WARMCACHE_SECTOR, d);
+  if (d->magic != WARM_MAGIC || d->cnt > WARM_MAX)
+    d->cnt = 0;
+  for (i = 0; i < d->cnt; i++)
+    if (d->sectors[i] >= block_size (fs_device)
+        || (i > 0 && d->sectors[i] <= d->sectors[i - 1]))
+      d->cnt = 0;
+
+  if (d->cnt > 0)
+    {
+      pool_pages = DIV_ROUND_UP (d->cnt * BLOCK_SECTOR_SIZE, PGSIZE);
+      pool = palloc_get_multiple (0, pool_pages);
+      entries = malloc (d->cnt * sizeof *entries);
+      reqs = malloc (d->cnt * sizeof *reqs);
+      if (pool == NULL || entries == NULL || reqs == NULL)
+        {
+          if (pool != NULL)
+            palloc_free_multiple (pool, pool_pages);
+          free (entries);
+          free (reqs);
+          pool = NULL;
+          entries = NULL;
+          reqs = NULL;
+          d->cnt = 0;
+        }
+    }
+
+  for (i = 0; i < d->cnt; i++)
+    {
+      entries[i].sector = d->sectors[i];
+      entries[i].state = WARM_PENDING;
+    }
+  entry_cnt = d->cnt;
+
+  /* Queue everything at once, a run of sectors per request. */
+  for (i = 0; i < entry_cnt; )
+    {
+      size_t j = i + 1;
+
+      while (j < entry_cnt && j - i < WARM_RUN
+             && entries[j].sector == entries[j - 1].sector + 1)
+        j++;
+      iosched_submit (&reqs[req_cnt++], entries[i].sector, j - i,
+                      pool + i * BLOCK_SECTOR_SIZE, false,
+                      prefetch_done, &entries[i]);
+      i = j;
+    }
+
+  free (d);
+  quiet = false;
+}
+
+/* Waits for outstanding prefetches, then writes the list of the
+   most often read sectors to disk for the next boot. */
+void
+warmcache_done (void)
+{
+  struct warm_disk *d;
+  size_t i, cnt;
+
+  quiet = true;
+  for (i = 0; i < req_cnt; i++)
+    iosched_wait (&reqs[i]);
+
+  /* The journal and this list are not worth prefetching. */
+  cnt = 0;
+  for (i = 0; i < WARM_TRACK; i++)
+    if (counts[i].cnt > 0
+        && (counts[i].sector < JOURNAL_SECTOR
+            || counts[i].sector > WARMCACHE_SECTOR))
+      counts[cnt++] = counts[i];
+  qsort (counts, cnt, sizeof *counts, count_more);
+  if (cnt > WARM_MAX)
+    cnt = WARM_MAX;
+  qsort (counts, cnt, sizeof *counts, sector_less);
+
+  d = calloc (1, sizeof *d);
+  if (d != NULL)
+    {
+      d->magic = WARM_MAGIC;
+      d->cnt = cnt;
+      for (i = 0; i < cnt; i++)
+        d->sectors[i] = counts[i].sector;
+      iosched_write (WARMCACHE_SECTOR, d);
+      saved_cnt = cnt;
+      free (d);
+    }
+
+  if (pool != NULL)
+    palloc_free_multiple (pool, pool_pages);
+  free (entries);
+  free (reqs);
+  free (counts);
+  pool = NULL;
+  entries = NULL;
+  entry_cnt = 0;
+  reqs = NULL;
+  req_cnt = 0;
+  counts = NULL;
+}
+
+/* Counts a read of CNT sectors starting at SECTOR and, if all
+   of them have been prefetched, copies them into BUFFER and
+   returns true.  Otherwise returns false and the caller must
+   read them from the device. */
+bool
+warmcache_read (block_sector_t sector, size_t cnt, void *buffer)
+{
+  struct warm_entry *e;
+  enum intr_level old_level;
+  bool valid = true;
+  size_t i;
+
+  if (quiet)
+    return false;
+
+  old_level = intr_disable ();
+  for (i = 0; i < cnt; i++)
+    count_read (sector + i);
+  e = find_entry (sector);
+  for (i = 0; i < cnt && valid; i++)
+    valid = (e != NULL && e + i < entries + entry_cnt
+             && e[i].sector == sector + i && e[i].state == WARM_VALID);
+  if (valid)
+    hit_cnt += cnt;
+  intr_set_level (old_level);
+
+  /* A valid copy never changes, so it can be copied without
+     interrupts off. */
+  if (valid)
+    memcpy (buffer, pool + (e - entries) * BLOCK_SECTOR_SIZE,
+            cnt * BLOCK_SECTOR_SIZE);
+  return valid;
+}
+
+/* Discards any prefetched copy of the CNT sectors starting at
+   SECTOR, which are about to be written. */
+void
+warmcache_invalidate (block_sector_t sector, size_t cnt)
+{
+  enum intr_level old_level;
+  size_t lo = 0, hi = entry_cnt;
+
+  if (entry_cnt == 0)
+    return;
+
+  /* Find the first entry at or above SECTOR. */
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (entries[mid].sector < sector)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  old_level = intr_disable ();
+  for (; lo < entry_cnt && entries[lo].sector < sector + cnt; lo++)
+    if (entries[lo].state != WARM_STALE)
+      {
+        entries[lo].state = WARM_STALE;
+        stale_cnt++;
+      }
+  intr_set_level (old_level);
+}
+
+/* Prints warm cache statistics. */
+void
+warmcache_print_stats (void)
+{
+  printf ("Warm cache: %zu sectors prefetched in %zu requests, "
+          "%llu sectors served, %llu discarded, %zu saved\n",
+          entry_cnt, req_cnt, hit_cnt, stale_cnt, saved_cnt);
+}
+
+/* Marks the sectors read by prefetch request R valid, unless
+   they were written meanwhile.  AUX is R's first entry.  Called
+   from the I/O thread. */
+static void
+prefetch_done (struct io_request *r, void *aux)
+{
+  struct warm_entry *e = aux;
+  enum intr_level old_level;
+  size_t i;
+
+  old_level = intr_disable ();
+  for (i = 0; i < r->cnt; i++)
+    if (e[i].state == WARM_PENDING)
+      e[i].state = WARM_VALID;
+  intr_set_level (old_level);
+}
+
+/* Returns the entry for SECTOR, or a null pointer if SECTOR was
+   not prefetched. */
+static struct warm_entry *
+find_entry (block_sector_t sector)
+{
+  size_t lo = 0, hi = entry_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (entries[mid].sector == sector)
+        return &entries[mid];
+      else if (entries[mid].sector < sector)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return NULL;
+}
+
+/* Counts one read of SECTOR.  Interrupts must be off. */
+static void
+count_read (block_sector_t sector)
+{
+  size_t i = hash_int (sector) % WARM_TRACK;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (;;)
+    {
+      if (counts[i].cnt > 0 && counts[i].sector == sector)
+        {
+          if (counts[i].cnt < UINT32_MAX)
+            counts[i].cnt++;
+          return;
+        }
+      else if (counts[i].cnt == 0)
+        {
+          if (count_used >= WARM_TRACK / 4 * 3)
+            return;
+          counts[i].sector = sector;
+          counts[i].cnt = 1;
+          count_used++;
+          return;
+        }
+      i = (i + 1) % WARM_TRACK;
+    }
+}
+
+/* Orders read counts by descending count. */
+static int
+count_more (const void *a_, const void *b_)
+{
+  const struct warm_count *a = a_, *b = b_;
+  return a->cnt < b->cnt ? 1 : a->cnt > b->cnt ? -1 : 0;
+}
+
+/* Orders read counts by ascending sector. */
+static int
+sector_less (const void *a_, const void *b_)
+{
+  const struct warm_count *a = a_, *b = b_;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
@@ -0,0 +1,19 @@
+#ifndef FILESYS_WARMCACHE_H
+#define FILESYS_WARMCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+#include "filesys/journal.h"
+
+/* Reserved sector, just past the journal, listing the sectors to
+   prefetch at the next boot. */
+#define WARMCACHE_SECTOR (JOURNAL_SECTOR + JOURNAL_SECTORS)
+
+void warmcache_init (bool format);
+void warmcache_done (void);
+bool warmcache_read (block_sector_t, size_t cnt, void *);
+void warmcache_invalidate (block_sector_t, size_t cnt);
+void warmcache_print_stats (void);
+
+#endif /* filesys/warmcache.h */
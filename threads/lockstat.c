@@ -0,0 +1,270 @@
+#include "threads/lockstat.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Lock contention profiler.
+
+   A lock initialized with lock_init_named() and taken through
+   lockstat_acquire() and lockstat_release() is counted against
+   the class of locks sharing its name, so that, for instance,
+   every buffer cache block lock adds up under "cache_block".
+   For each class we count acquisitions, acquisitions that had
+   to wait, and the total and maximum ticks spent waiting for
+   and holding the lock.
+
+   Everything lives in static tables, because some locks are
+   named before the page allocator is up.  A lock for which no
+   table slot is left simply goes unprofiled.  A lock embedded in
+   an object that is freed must be passed to lockstat_forget()
+   first, to give its slot back. */
+
+/* Maximum number of lock names and of profiled locks. */
+#define LOCK_CLASS_CNT 32
+#define LOCK_ENTRY_CNT 512
+
+/* Statistics for all locks with one name. */
+struct lock_class
+  {
+    const char *name;                   /* Name given to lock_init_named(). */
+    unsigned long long acquire_cnt;     /* Acquisitions. */
+    unsigned long long contended_cnt;   /* Acquisitions that waited. */
+    int64_t wait_ticks;                 /* Total ticks waiting. */
+    int64_t max_wait_ticks;             /* Longest wait. */
+    int64_t hold_ticks;                 /* Total ticks held. */
+    int64_t max_hold_ticks;             /* Longest hold. */
+  };
+
+/* A profiled lock. */
+struct lock_entry
+  {
+    struct lock *lock;                  /* The lock, or null if free. */
+    struct lock_class *class;           /* Its class. */
+    int64_t acquired_at;                /* Tick of last acquisition. */
+  };
+
+/* If true, named locks are profiled and lockstat_print() reports
+   on them.  Controlled by kernel command-line option
+   "-o lockstat". */
+bool lockstat_enabled;
+
+static struct lock_class classes[LOCK_CLASS_CNT];
+static struct lock_entry entries[LOCK_ENTRY_CNT];
+
+static struct lock_class *find_class (const char *name);
+static struct lock_entry *find_entry (struct lock *, bool create);
+
+/* Initializes LOCK like lock_init() and, if profiling is
+   enabled, starts profiling it under NAME, which must remain
+   valid.  Initializing the same lock again is harmless. */
+void
+lock_init_named (struct lock *lock, const char *name)
+{
+  enum intr_level old_level;
+  struct lock_class *class;
+  struct lock_entry *entry;
+
+  lock_init (lock);
+  if (!lockstat_enabled)
+    return;
+
+  old_level = intr_disable ();
+  class = find_class (name);
+  entry = find_entry (lock, class != NULL);
+  if (entry != NULL)
+    entry->class = class;
+  intr_set_level (old_level);
+}
+
+/* Stops profiling LOCK, which is about to be freed.  Its class
+   keeps the statistics gathered so far.  Does nothing if LOCK is
+   not profiled. */
+void
+lockstat_forget (struct lock *lock)
+{
+  enum intr_level old_level;
+  struct lock_entry *entry;
+
+  if (!lockstat_enabled)
+    return;
+
+  old_level = intr_disable ();
+  entry = find_entry (lock, false);
+  if (entry != NULL)
+    {
+      size_t i = entry - entries;
+      size_t j = i;
+
+      /* Close the gap, moving up any later entry in the same run
+         that could no longer be found past it. */
+      entries[i].lock = NULL;
+      for (;;)
+        {
+          size_t home;
+
+          j = (j + 1) % LOCK_ENTRY_CNT;
+          if (entries[j].lock == NULL)
+            break;
+          home = ((uintptr_t) entries[j].lock >> 3) % LOCK_ENTRY_CNT;
+          if ((j > i && (home <= i || home > j))
+              || (j < i && home <= i && home > j))
+            {
+              entries[i] = entries[j];
+              entries[j].lock = NULL;
+              i = j;
+            }
+        }
+    }
+  intr_set_level (old_level);
+}
+
+/* Acquires LOCK like lock_acquire(), recording how long we had
+   to wait for it.  The wait is charged to the current thread's
+   accounting even when profiling is off. */
+void
+lockstat_acquire (struct lock *lock)
+{
+  struct lock_entry *entry;
+  struct lock_class *class;
+  enum intr_level old_level;
+  int64_t start, wait = 0;
+  bool contended = false;
+
+  if (!lock_try_acquire (lock))
+    {
+      contended = true;
+      start = timer_ticks ();
+      lock_acquire (lock);
+      wait = timer_ticks () - start;
+      thread_current ()->stats.lock_wait_ticks += wait;
+    }
+  if (!lockstat_enabled)
+    return;
+
+  old_level = intr_disable ();
+  entry = find_entry (lock, false);
+  if (entry != NULL)
+    {
+      class = entry->class;
+      entry->acquired_at = timer_ticks ();
+      class->acquire_cnt++;
+      if (contended)
+        {
+          class->contended_cnt++;
+          class->wait_ticks += wait;
+          if (wait > class->max_wait_ticks)
+            class->max_wait_ticks = wait;
+        }
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases LOCK like lock_release(), recording how long it was
+   held. */
+void
+lockstat_release (struct lock *lock)
+{
+  struct lock_entry *entry;
+  enum intr_level old_level;
+
+  if (lockstat_enabled)
+    {
+      old_level = intr_disable ();
+      entry = find_entry (lock, false);
+      if (entry != NULL)
+        {
+          struct lock_class *class = entry->class;
+          int64_t hold = timer_ticks () - entry->acquired_at;
+          class->hold_ticks += hold;
+          if (hold > class->max_hold_ticks)
+            class->max_hold_ticks = hold;
+        }
+      intr_set_level (old_level);
+    }
+  lock_release (lock);
+}
+
+/* Prints lock statistics, most waited-for lock class first. */
+void
+lockstat_print (void)
+{
+  struct lock_class *sorted[LOCK_CLASS_CNT];
+  size_t cnt = 0;
+  size_t i, j;
+
+  if (!lockstat_enabled)
+    return;
+
+  for (i = 0; i < LOCK_CLASS_CNT && classes[i].name != NULL; i++)
+    {
+      struct lock_class *c = &classes[i];
+      for (j = cnt; j > 0 && sorted[j - 1]->wait_ticks < c->wait_ticks; j--)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = c;
+      cnt++;
+    }
+
+  printf ("Locks: name, acquisitions, contended, "
+          "wait ticks (total/max), hold ticks (total/max)\n");
+  for (i = 0; i < cnt; i++)
+    {
+      struct lock_class *c = sorted[i];
+      printf ("Lock %s: %llu %llu %"PRId64"/%"PRId64" %"PRId64"/%"PRId64"\n",
+              c->name, c->acquire_cnt, c->contended_cnt,
+              c->wait_ticks, c->max_wait_ticks,
+              c->hold_ticks, c->max_hold_ticks);
+    }
+}
+
+/* Returns the class for NAME, creating it if necessary, or a
+   null pointer if the class table is full. */
+static struct lock_class *
+find_class (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < LOCK_CLASS_CNT; i++)
+    {
+      struct lock_class *c = &classes[i];
+      if (c->name == NULL)
+        {
+          c->name = name;
+          return c;
+        }
+      if (!strcmp (c->name, name))
+        return c;
+    }
+  return NULL;
+}
+
+/* Returns the entry for LOCK.  If there is none, returns a new
+   entry if CREATE is true and the table is not full, and a null
+   pointer otherwise.  Interrupts must be off. */
+static struct lock_entry *
+find_entry (struct lock *lock, bool create)
+{
+  size_t start = ((uintptr_t) lock >> 3) % LOCK_ENTRY_CNT;
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < LOCK_ENTRY_CNT; i++)
+    {
+      struct lock_entry *e = &entries[(start + i) % LOCK_ENTRY_CNT];
+      if (e->lock == lock)
+        return e;
+      if (e->lock == NULL)
+        {
+          if (!create)
+            return NULL;
+          e->lock = lock;
+          return e;
+        }
+    }
+  return NULL;
+}
@@ -0,0 +1,18 @@
+#ifndef THREADS_LOCKSTAT_H
+#define THREADS_LOCKSTAT_H
+
+#include <stdbool.h>
+#include "threads/synch.h"
+
+/* If true, named locks are profiled and lockstat_print() reports
+   on them.  Controlled by kernel command-line option
+   "-o lockstat". */
+extern bool lockstat_enabled;
+
+void lock_init_named (struct lock *, const char *name);
+void lockstat_forget (struct lock *);
+void lockstat_acquire (struct lock *);
+void lockstat_release (struct lock *);
+void lockstat_print (void);
+
+#endif /* threads/lockstat.h */
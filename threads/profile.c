@@ -0,0 +1,96 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Sampling CPU profiler.
+
+   Every PROFILE_INTERVAL timer ticks, the timer interrupt handler
+   passes us the interrupted frame.  We count the interrupted EIP,
+   whether it was in user or kernel mode, and the running thread
+   in a fixed-size hash table.  profile_print() dumps the table as
+   "Profile:" lines at shutdown; utils/pintos-prof resolves those
+   against the kernel (and optionally a user program) ELF file on
+   the host. */
+
+/* Number of distinct samples the table can hold. */
+#define PROFILE_SLOTS 2048
+
+/* One histogram bucket. */
+struct profile_slot
+  {
+    uint32_t eip;               /* Interrupted instruction. */
+    tid_t tid;                  /* Running thread. */
+    bool user;                  /* Interrupted in user mode? */
+    unsigned cnt;               /* Number of samples, 0 if unused. */
+  };
+
+/* Take a sample every PROFILE_INTERVAL timer ticks, or never if
+   0.  Controlled by kernel command-line option "-profile=N". */
+unsigned profile_interval;
+
+static struct profile_slot slots[PROFILE_SLOTS];
+static unsigned tick_cnt;       /* Ticks since last sample. */
+static unsigned sample_cnt;     /* Samples taken. */
+static unsigned lost_cnt;       /* Samples dropped, table full. */
+
+/* Called from the timer interrupt handler with the interrupted
+   frame F. */
+void
+profile_tick (const struct intr_frame *f)
+{
+  uint32_t eip = (uint32_t) f->eip;
+  bool user = (f->cs & 3) == 3;
+  tid_t tid = thread_tid ();
+  size_t start, i;
+
+  ASSERT (intr_context ());
+
+  if (profile_interval == 0 || ++tick_cnt < profile_interval)
+    return;
+  tick_cnt = 0;
+  sample_cnt++;
+
+  start = (eip ^ ((uint32_t) tid << 20) ^ user) % PROFILE_SLOTS;
+  for (i = 0; i < PROFILE_SLOTS; i++)
+    {
+      struct profile_slot *s = &slots[(start + i) % PROFILE_SLOTS];
+      if (s->cnt == 0)
+        {
+          s->eip = eip;
+          s->tid = tid;
+          s->user = user;
+        }
+      if (s->eip == eip && s->tid == tid && s->user == user)
+        {
+          s->cnt++;
+          return;
+        }
+    }
+  lost_cnt++;
+}
+
+/* Prints the samples, one "Profile:" line per distinct EIP,
+   mode and thread. */
+void
+profile_print (void)
+{
+  size_t i;
+
+  if (profile_interval == 0)
+    return;
+
+  printf ("Profile: %u samples every %u ticks, %u lost\n",
+          sample_cnt, profile_interval, lost_cnt);
+  for (i = 0; i < PROFILE_SLOTS; i++)
+    {
+      struct profile_slot *s = &slots[i];
+      if (s->cnt != 0)
+        printf ("Profile: %08"PRIx32" %c %d %u\n",
+                s->eip, s->user ? 'u' : 'k', s->tid, s->cnt);
+    }
+}
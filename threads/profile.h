@@ -0,0 +1,13 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+struct intr_frame;
+
+/* Take a sample every PROFILE_INTERVAL timer ticks, or never if
+   0.  Controlled by kernel command-line option "-profile=N". */
+extern unsigned profile_interval;
+
+void profile_tick (const struct intr_frame *);
+void profile_print (void);
+
+#endif /* threads/profile.h */
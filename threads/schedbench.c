@@ -0,0 +1,285 @@
+#include "threads/schedbench.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/tsc.h"
+#include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/process.h"
+#endif
+
+/* Scheduler and synchronization microbenchmarks.
+
+   Each benchmark prints one line of the form
+     schedbench: test=NAME mode=MODE key=value...
+   where MODE is "rr" or "mlfqs", so that runs with and without
+   -o mlfqs can be collected and compared mechanically.  Times
+   are in CPU cycles, read from the timestamp counter. */
+
+/* Round trips in the context-switch benchmark. */
+#define PINGPONG_ITERS 10000
+
+/* Lock handoffs measured per chain depth. */
+#define CHAIN_ITERS 200
+#define CHAIN_MAX 8
+
+/* Threads created in the create/exit benchmark, and how many are
+   alive at once. */
+#define CREATE_ITERS 1024
+#define CREATE_BATCH 32
+
+/* Process round trips in the exec/wait benchmark. */
+#define EXEC_ITERS 20
+
+/* Timer ticks measured at each runnable-thread count. */
+#define TICK_WINDOW (2 * TIMER_FREQ)
+
+static const char *mode (void);
+static void bench_pingpong (void);
+static void bench_chain (int depth, int helper_priority);
+static void bench_create (void);
+static void bench_exec (const char *cmd_line);
+static void bench_tick (int thread_cnt);
+
+/* Runs every benchmark.  If CMD_LINE is non-null, also times
+   executing and waiting for it as a user process. */
+void
+schedbench_run (const char *cmd_line)
+{
+  static const int tick_threads[] = { 1, 10, 50, 100, 250, 500 };
+  size_t i;
+  int depth;
+
+  bench_pingpong ();
+  bench_chain (1, thread_get_priority ());
+  for (depth = 1; depth <= CHAIN_MAX; depth *= 2)
+    bench_chain (depth, PRI_MIN);
+  bench_create ();
+  if (cmd_line != NULL)
+    bench_exec (cmd_line);
+  for (i = 0; i < sizeof tick_threads / sizeof *tick_threads; i++)
+    bench_tick (tick_threads[i]);
+}
+
+/* Returns the name of the scheduler in use. */
+static const char *
+mode (void)
+{
+  return thread_mlfqs ? "mlfqs" : "rr";
+}
+
+/* Context-switch latency: two threads at the same priority
+   hand control back and forth with a pair of semaphores, two
+   switches per round trip. */
+static struct semaphore ping, pong;
+
+static void
+pong_thread (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < PINGPONG_ITERS; i++)
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+}
+
+static void
+bench_pingpong (void)
+{
+  uint64_t start, cycles;
+  int i;
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  thread_create ("pong", thread_get_priority (), pong_thread, NULL);
+
+  start = read_tsc ();
+  for (i = 0; i < PINGPONG_ITERS; i++)
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  cycles = read_tsc () - start;
+
+  printf ("schedbench: test=ctxswitch mode=%s iters=%d "
+          "cycles_per_switch=%"PRIu64"\n",
+          mode (), PINGPONG_ITERS, cycles / (2 * PINGPONG_ITERS));
+}
+
+/* Lock handoff latency: helper I holds chain_locks[I] and waits
+   for chain_locks[I + 1]; the last helper gives its lock up once
+   chain_go is set.  Acquiring chain_locks[0] thus waits for the
+   whole chain to unwind, donating priority down it when the
+   helpers run below the caller. */
+static struct lock chain_locks[CHAIN_MAX];
+static struct semaphore chain_ready;
+static volatile bool chain_go;
+static int chain_depth;
+
+static void
+chain_thread (void *aux)
+{
+  int i = (intptr_t) aux;
+
+  lock_acquire (&chain_locks[i]);
+  sema_up (&chain_ready);
+  if (i == chain_depth - 1)
+    while (!chain_go)
+      thread_yield ();
+  else
+    {
+      lock_acquire (&chain_locks[i + 1]);
+      lock_release (&chain_locks[i + 1]);
+    }
+  lock_release (&chain_locks[i]);
+}
+
+static void
+bench_chain (int depth, int helper_priority)
+{
+  uint64_t cycles = 0;
+  int iter, i;
+
+  ASSERT (depth > 0 && depth <= CHAIN_MAX);
+
+  chain_depth = depth;
+  for (i = 0; i < depth; i++)
+    lock_init (&chain_locks[i]);
+
+  for (iter = 0; iter < CHAIN_ITERS; iter++)
+    {
+      uint64_t start;
+
+      chain_go = false;
+      sema_init (&chain_ready, 0);
+      for (i = depth - 1; i >= 0; i--)
+        {
+          thread_create ("chain", helper_priority, chain_thread,
+                         (void *) (intptr_t) i);
+          sema_down (&chain_ready);
+        }
+
+      start = read_tsc ();
+      chain_go = true;
+      lock_acquire (&chain_locks[0]);
+      cycles += read_tsc () - start;
+      lock_release (&chain_locks[0]);
+    }
+
+  printf ("schedbench: test=lock mode=%s depth=%d donation=%s iters=%d "
+          "cycles_per_handoff=%"PRIu64"\n",
+          mode (), depth,
+          helper_priority < thread_get_priority () ? "yes" : "no",
+          CHAIN_ITERS, cycles / CHAIN_ITERS);
+}
+
+/* thread_create() and thread_exit() throughput. */
+static struct semaphore exit_sema;
+
+static void
+exit_thread (void *aux UNUSED)
+{
+  sema_up (&exit_sema);
+}
+
+static void
+bench_create (void)
+{
+  uint64_t start, cycles;
+  int created = 0;
+  int i;
+
+  sema_init (&exit_sema, 0);
+  start = read_tsc ();
+  while (created < CREATE_ITERS)
+    {
+      int batch = 0;
+
+      while (batch < CREATE_BATCH
+             && thread_create ("exit", thread_get_priority (),
+                               exit_thread, NULL) != TID_ERROR)
+        batch++;
+      if (batch == 0)
+        break;
+      for (i = 0; i < batch; i++)
+        sema_down (&exit_sema);
+      created += batch;
+    }
+  cycles = read_tsc () - start;
+
+  printf ("schedbench: test=create mode=%s iters=%d cycles_per_thread=%"
+          PRIu64"\n", mode (), created,
+          created > 0 ? cycles / created : 0);
+}
+
+/* exec/wait round trip for CMD_LINE. */
+static void
+bench_exec (const char *cmd_line)
+{
+#ifdef USERPROG
+  uint64_t start, cycles;
+  int64_t ticks;
+  int i;
+
+  ticks = timer_ticks ();
+  start = read_tsc ();
+  for (i = 0; i < EXEC_ITERS; i++)
+    process_wait (process_execute (cmd_line));
+  cycles = read_tsc () - start;
+  ticks = timer_elapsed (ticks);
+
+  printf ("schedbench: test=exec mode=%s iters=%d ticks=%"PRId64" "
+          "cycles_per_exec=%"PRIu64"\n",
+          mode (), EXEC_ITERS, ticks, cycles / EXEC_ITERS);
+#else
+  printf ("schedbench: test=exec skipped, no user programs (%s)\n",
+          cmd_line);
+#endif
+}
+
+/* Timer-interrupt overhead with THREAD_CNT runnable threads
+   spinning below the caller. */
+static struct semaphore spin_done;
+static volatile bool spin_stop;
+
+static void
+spin_thread (void *aux UNUSED)
+{
+  while (!spin_stop)
+    barrier ();
+  sema_up (&spin_done);
+}
+
+static void
+bench_tick (int thread_cnt)
+{
+  uint64_t cycles0, cycles1;
+  int64_t cnt0, cnt1;
+  int created, i;
+
+  spin_stop = false;
+  sema_init (&spin_done, 0);
+  for (created = 0; created < thread_cnt; created++)
+    if (thread_create ("spin", PRI_MIN, spin_thread, NULL) == TID_ERROR)
+      break;
+
+  timer_sleep (1);
+  thread_tick_overhead (&cycles0, &cnt0);
+  timer_sleep (TICK_WINDOW);
+  thread_tick_overhead (&cycles1, &cnt1);
+
+  spin_stop = true;
+  for (i = 0; i < created; i++)
+    sema_down (&spin_done);
+
+  printf ("schedbench: test=tick mode=%s threads=%d ticks=%"PRId64" "
+          "cycles_per_tick=%"PRIu64"\n",
+          mode (), created, cnt1 - cnt0,
+          cnt1 > cnt0 ? (cycles1 - cycles0) / (cnt1 - cnt0) : 0);
+}
@@ -0,0 +1,8 @@
+#ifndef THREADS_SCHEDBENCH_H
+#define THREADS_SCHEDBENCH_H
+
+/* Runs the scheduler microbenchmarks.
+   Started by kernel command-line action "schedbench [CMD]". */
+void schedbench_run (const char *cmd_line);
+
+#endif /* threads/schedbench.h */
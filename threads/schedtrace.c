@@ -0,0 +1,94 @@
+#include "threads/schedtrace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/tsc.h"
+#include "devices/timer.h"
+
+/* Scheduler event trace.
+
+   Events are recorded into a fixed-size ring buffer, so that
+   tracing costs a few stores per event and never allocates or
+   prints.  Once the buffer is full the oldest events are
+   overwritten.  The trace is read out with sched_trace_copy()
+   (for the schedtrace system call) or sched_trace_dump(). */
+
+/* Number of events kept. */
+#define SCHED_TRACE_SIZE 1024
+
+/* If true, scheduler events are recorded.
+   Controlled by kernel command-line option "-o schedtrace". */
+bool sched_trace_enabled;
+
+static struct sched_event events[SCHED_TRACE_SIZE];
+static uint64_t event_cnt;      /* Events recorded since boot. */
+
+static const char *event_names[] =
+  {
+    "switch", "block", "unblock", "yield", "priority", "donate"
+  };
+
+/* Records an event of the given TYPE, if tracing is enabled.
+   May be called from interrupt context. */
+void
+sched_trace_record (enum sched_event_type type, int tid, int other, int arg)
+{
+  struct sched_event *e;
+  enum intr_level old_level;
+
+  if (!sched_trace_enabled)
+    return;
+
+  old_level = intr_disable ();
+  e = &events[event_cnt++ % SCHED_TRACE_SIZE];
+  e->tsc = read_tsc ();
+  e->tick = timer_ticks ();
+  e->type = type;
+  e->tid = tid;
+  e->other = other;
+  e->arg = arg;
+  intr_set_level (old_level);
+}
+
+/* Copies up to MAX_CNT of the most recent events, oldest first,
+   into DST.  Returns the number of events copied. */
+size_t
+sched_trace_copy (struct sched_event *dst, size_t max_cnt)
+{
+  enum intr_level old_level;
+  uint64_t first;
+  size_t i, cnt;
+
+  old_level = intr_disable ();
+  cnt = event_cnt < SCHED_TRACE_SIZE ? event_cnt : SCHED_TRACE_SIZE;
+  if (cnt > max_cnt)
+    cnt = max_cnt;
+  first = event_cnt - cnt;
+  for (i = 0; i < cnt; i++)
+    dst[i] = events[(first + i) % SCHED_TRACE_SIZE];
+  intr_set_level (old_level);
+
+  return cnt;
+}
+
+/* Prints the recorded events, oldest first. */
+void
+sched_trace_dump (void)
+{
+  uint64_t i, first;
+
+  if (!sched_trace_enabled)
+    return;
+
+  first = event_cnt > SCHED_TRACE_SIZE ? event_cnt - SCHED_TRACE_SIZE : 0;
+  printf ("Scheduler trace: %"PRIu64" events, last %"PRIu64" shown\n",
+          event_cnt, event_cnt - first);
+  for (i = first; i < event_cnt; i++)
+    {
+      struct sched_event *e = &events[i % SCHED_TRACE_SIZE];
+      printf ("%"PRId64" %"PRIu64" %s tid=%d other=%d arg=%d\n",
+              e->tick, e->tsc, event_names[e->type],
+              e->tid, e->other, e->arg);
+    }
+}
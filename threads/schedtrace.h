@@ -0,0 +1,38 @@
+#ifndef THREADS_SCHEDTRACE_H
+#define THREADS_SCHEDTRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kinds of scheduler event. */
+enum sched_event_type
+  {
+    SCHED_SWITCH,               /* TID, now in state ARG, switched to OTHER. */
+    SCHED_BLOCK,                /* TID blocked. */
+    SCHED_UNBLOCK,              /* TID made ready at priority ARG. */
+    SCHED_YIELD,                /* TID yielded. */
+    SCHED_PRIORITY,             /* TID's priority set to ARG. */
+    SCHED_DONATE                /* OTHER donated priority ARG to TID. */
+  };
+
+/* One recorded event. */
+struct sched_event
+  {
+    uint64_t tsc;               /* CPU timestamp counter. */
+    int64_t tick;               /* Timer tick. */
+    int type;                   /* enum sched_event_type. */
+    int tid;                    /* Thread the event is about. */
+    int other;                  /* Other thread involved, or 0. */
+    int arg;                    /* Event-specific argument. */
+  };
+
+/* If true, scheduler events are recorded.
+   Controlled by kernel command-line option "-o schedtrace". */
+extern bool sched_trace_enabled;
+
+void sched_trace_record (enum sched_event_type, int tid, int other, int arg);
+size_t sched_trace_copy (struct sched_event *, size_t max_cnt);
+void sched_trace_dump (void);
+
+#endif /* threads/schedtrace.h */
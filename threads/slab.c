@@ -0,0 +1,204 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A slab allocator for frequently created kernel objects.
+
+   Each slab_cache hands out objects of a single size.  Objects
+   are packed into pages obtained from the page allocator, each
+   page ("slab") beginning with a struct slab header followed by
+   as many object slots as fit.  Every slot ends with a link
+   used to chain it onto its slab's free list while the object
+   is free, so the object itself is never overwritten and keeps
+   whatever state the constructor gave it.
+
+   The slab that owns an object is found by rounding the object's
+   address down to a page boundary, the same trick malloc() uses
+   to find a block's arena.
+
+   A slab that becomes entirely free is returned to the page
+   allocator, unless it is the only slab with free slots left in
+   its cache. */
+
+/* Magic number for detecting corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of each page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in cache's slabs list. */
+    size_t used;                /* Number of allocated objects. */
+    void *free;                 /* First free object, or null. */
+  };
+
+/* Offset of the first object slot within a slab. */
+#define SLAB_HEADER_SIZE ROUND_UP (sizeof (struct slab), 8)
+
+/* List of all caches, for slab_print_stats(). */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static struct slab *obj_to_slab (void *);
+static void **free_link (struct slab_cache *, void *);
+static struct slab *slab_grow (struct slab_cache *);
+
+/* Initializes CACHE to allocate objects of OBJ_SIZE bytes,
+   each passed to CTOR, if non-null, when first created.
+   NAME is used only for statistics and must remain valid. */
+void
+slab_cache_init (struct slab_cache *cache, const char *name,
+                 size_t obj_size, slab_ctor_func *ctor)
+{
+  enum intr_level old_level;
+
+  ASSERT (cache != NULL);
+  ASSERT (obj_size > 0);
+
+  cache->name = name;
+  cache->obj_size = obj_size;
+  cache->slot_size = ROUND_UP (obj_size, 8) + 8;
+  ASSERT (cache->slot_size <= PGSIZE - SLAB_HEADER_SIZE);
+  cache->slots_per_slab = (PGSIZE - SLAB_HEADER_SIZE) / cache->slot_size;
+  cache->ctor = ctor;
+  lock_init (&cache->lock);
+  list_init (&cache->slabs);
+  cache->page_cnt = 0;
+  cache->in_use = 0;
+  cache->alloc_cnt = 0;
+  cache->free_cnt = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&all_caches, &cache->elem);
+  intr_set_level (old_level);
+}
+
+/* Obtains and returns a new object from CACHE, or a null
+   pointer if no memory is available. */
+void *
+slab_alloc (struct slab_cache *cache)
+{
+  struct slab *s;
+  void *obj = NULL;
+
+  lock_acquire (&cache->lock);
+  if (list_empty (&cache->slabs))
+    s = slab_grow (cache);
+  else
+    s = list_entry (list_front (&cache->slabs), struct slab, elem);
+
+  if (s != NULL)
+    {
+      obj = s->free;
+      s->free = *free_link (cache, obj);
+      if (++s->used == cache->slots_per_slab)
+        list_remove (&s->elem);
+      cache->in_use++;
+      cache->alloc_cnt++;
+    }
+  lock_release (&cache->lock);
+
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from CACHE, to
+   CACHE.  Does nothing if OBJ is a null pointer. */
+void
+slab_free (struct slab_cache *cache, void *obj)
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (obj);
+  ASSERT (s->cache == cache);
+
+  lock_acquire (&cache->lock);
+  if (s->used-- == cache->slots_per_slab)
+    list_push_front (&cache->slabs, &s->elem);
+  *free_link (cache, obj) = s->free;
+  s->free = obj;
+  cache->in_use--;
+  cache->free_cnt++;
+
+  /* Give an entirely free slab back, keeping at least one. */
+  if (s->used == 0 && list_size (&cache->slabs) > 1)
+    {
+      list_remove (&s->elem);
+      s->magic = 0;
+      palloc_free_page (s);
+      cache->page_cnt--;
+    }
+  lock_release (&cache->lock);
+}
+
+/* Prints usage statistics for every cache. */
+void
+slab_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      printf ("Slab %s: %zu bytes, %zu in use, %zu pages, "
+              "%llu allocs, %llu frees\n",
+              c->name, c->obj_size, c->in_use, c->page_cnt,
+              c->alloc_cnt, c->free_cnt);
+    }
+}
+
+/* Returns the slab that OBJ was allocated from. */
+static struct slab *
+obj_to_slab (void *obj)
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT ((uint8_t *) obj >= (uint8_t *) s + SLAB_HEADER_SIZE);
+  return s;
+}
+
+/* Returns the free-list link at the end of OBJ's slot. */
+static void **
+free_link (struct slab_cache *cache, void *obj)
+{
+  return (void **) ((uint8_t *) obj + cache->slot_size - 8);
+}
+
+/* Adds a new slab to CACHE, constructing all of its objects.
+   Returns the new slab, or a null pointer if no page is
+   available.  CACHE's lock must be held. */
+static struct slab *
+slab_grow (struct slab_cache *cache)
+{
+  struct slab *s;
+  size_t i;
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = cache;
+  s->used = 0;
+  s->free = NULL;
+  for (i = cache->slots_per_slab; i-- > 0; )
+    {
+      void *obj = (uint8_t *) s + SLAB_HEADER_SIZE + i * cache->slot_size;
+      if (cache->ctor != NULL)
+        cache->ctor (obj);
+      *free_link (cache, obj) = s->free;
+      s->free = obj;
+    }
+  list_push_back (&cache->slabs, &s->elem);
+  cache->page_cnt++;
+  return s;
+}
@@ -0,0 +1,39 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Initializes a newly carved object.  Called once per object
+   slot, when its page is first obtained, not on every
+   slab_alloc(): objects keep their constructed state across
+   slab_free() and slab_alloc(). */
+typedef void slab_ctor_func (void *obj);
+
+/* A cache of fixed-size objects of one type. */
+struct slab_cache
+  {
+    struct list_elem elem;      /* Element in list of all caches. */
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t slot_size;           /* Object plus free-list link. */
+    size_t slots_per_slab;      /* Objects per page. */
+    slab_ctor_func *ctor;       /* Constructor, or null. */
+    struct lock lock;           /* Protects the members below. */
+    struct list slabs;          /* Slabs with at least one free slot. */
+
+    /* Statistics. */
+    size_t page_cnt;            /* Pages currently held. */
+    size_t in_use;              /* Objects currently allocated. */
+    unsigned long long alloc_cnt; /* Total slab_alloc() calls. */
+    unsigned long long free_cnt;  /* Total slab_free() calls. */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t obj_size,
+                      slab_ctor_func *);
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
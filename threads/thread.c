@@ -3,13 +3,19 @@
 #include <stddef.h>
 #include <random.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
+#include "threads/malloc.h"
+#include "threads/lockstat.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
+#include "threads/schedtrace.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/tsc.h"
 #include "threads/vaddr.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -26,8 +32,25 @@
 //#define Q 14
 #define F 16384
 
+/* Number of buckets in the tid hash tables. */
+#define TID_HASH_SIZE 64
+
+/* Threads and child_info records hashed by tid, so that
+   getThreadFromTid() and getCIFromTid() need not walk every
+   thread or every child ever created.  Buckets are lists so the
+   tables work before malloc() is initialized. */
+static struct list thread_hash[TID_HASH_SIZE];
+static struct list child_info_hash[TID_HASH_SIZE];
+
+/* child_info records linked through their elem members, as
+   userprog/process.c still registers them.  getCIFromTid() looks
+   here for records not entered with child_info_add(). */
 struct list child_info_list;
 
+/* Lock protecting child_info records while a parent and its
+   children exit concurrently. */
+static struct lock child_lock;
+
 static int gl_load_avg;
 
 //static struct list mlfqs_queues[PRI_MAX+1];
@@ -36,10 +59,21 @@ static int gl_load_avg;
    that are ready to run but not actually running. */
 static struct list ready_list;
 
+/* List of processes sleeping in thread_sleep(), ordered by
+   wakeup tick, so that thread_tick() need only look at the
+   front. */
+static struct list sleep_list;
+
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
+/* Pages of dead threads, kept for reuse by thread_create() so
+   that it need not go to the page allocator and zero a whole
+   page.  Linked through each dead thread's `elem'. */
+#define THREAD_PAGE_CACHE_MAX 16
+static struct list free_thread_pages;
+
 /* Idle thread. */
 static struct thread *idle_thread;
 
@@ -61,16 +95,33 @@ struct kernel_thread_frame
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
+static uint64_t tick_cycles;    /* # of CPU cycles spent in thread_tick(). */
+static int64_t tick_cnt;        /* # of calls to thread_tick(). */
 
 /* Scheduling. */
-#define TIME_SLICE 4            /* # of timer ticks to give each thread. */
+#define TIME_SLICE 4            /* Default time slice at high priority. */
+#define TIME_SLICE_LONG 16      /* Default time slice at PRI_MIN. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 
+/* # of timer ticks to give a thread at each priority.  Threads at
+   PRI_DEFAULT and above get the shortest slice, keeping
+   interactive latency low; below that the slice grows linearly
+   up to the longest one at PRI_MIN, so CPU-bound batch work
+   switches less often.  Set by thread_set_time_slices(). */
+static unsigned time_slice[PRI_MAX + 1];
+
+static void init_time_slices (unsigned short_slice, unsigned long_slice);
+static unsigned thread_time_slice (int priority);
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* If true, print each thread's accounting when it exits.
+   Controlled by kernel command-line option "-o acct". */
+bool thread_acct;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
@@ -82,6 +133,14 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static struct thread *alloc_thread_page (void);
+static bool compare_wakeup (const struct list_elem *,
+                            const struct list_elem *, void *aux);
+static void wake_sleepers (int64_t now);
+static struct list *tid_bucket (struct list *table, tid_t tid);
+#ifdef USERPROG
+static void child_info_release (struct thread *t);
+#endif
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -100,12 +159,25 @@ static tid_t allocate_tid (void);
 void
 thread_init (void) 
 {
-	//int i;
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&tid_lock);
+  lock_init_named (&tid_lock, "tid_lock");
   list_init (&ready_list);
+  list_init (&sleep_list);
   list_init (&all_list);
+  list_init (&free_thread_pages);
+  /* Command-line options are parsed before we are called, so
+     keep any time slices they set. */
+  if (time_slice[PRI_MAX] == 0)
+    init_time_slices (TIME_SLICE, TIME_SLICE_LONG);
+  for (i = 0; i < TID_HASH_SIZE; i++)
+    {
+      list_init (&thread_hash[i]);
+      list_init (&child_info_hash[i]);
+    }
+  list_init (&child_info_list);
 
 	if(thread_mlfqs){
 		gl_load_avg = 0;
@@ -115,13 +187,15 @@ thread_init (void)
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  list_push_back (tid_bucket (thread_hash, initial_thread->tid),
+                  &initial_thread->tidelem);
 	if(thread_mlfqs){
 		initial_thread->nice = 0;
 		initial_thread->recent_cpu = 0;
 	}
 
 #ifdef USERPROG
-	list_init(&child_info_list);
+	lock_init(&child_lock);
 #endif
 }
 
@@ -149,20 +223,28 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  uint64_t start = read_tsc ();
 
   /* Update statistics. */
   if (t == idle_thread)
     idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
-    user_ticks++;
+    {
+      user_ticks++;
+      t->stats.user_ticks++;
+    }
 #endif
   else
-    kernel_ticks++;
+    {
+      kernel_ticks++;
+      t->stats.kernel_ticks++;
+    }
 
+  wake_sleepers (timer_ticks ());
 
   /* Enforce preemption. */
- 	if (++thread_ticks >= TIME_SLICE)
+ 	if (++thread_ticks >= thread_time_slice (t->priority))
   //++thread_ticks;
 		intr_yield_on_return ();
 
@@ -179,6 +261,20 @@ thread_tick (void)
 			recalc_pri();
 		}
 	}
+
+  tick_cycles += read_tsc () - start;
+  tick_cnt++;
+}
+
+/* Stores the total number of CPU cycles spent in thread_tick()
+   into *CYCLES and the number of calls into *CNT. */
+void
+thread_tick_overhead (uint64_t *cycles, int64_t *cnt)
+{
+  enum intr_level old_level = intr_disable ();
+  *cycles = tick_cycles;
+  *cnt = tick_cnt;
+  intr_set_level (old_level);
 }
 
 
@@ -215,6 +311,67 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  sched_trace_dump ();
+  lockstat_print ();
+  profile_print ();
+}
+
+/* Prints the accounting of thread T. */
+void
+thread_print_acct (struct thread *t)
+{
+  struct thread_stats *s = &t->stats;
+
+  printf ("%s: %lld user ticks, %lld kernel ticks, "
+          "%u voluntary and %u involuntary switches\n",
+          t->name, s->user_ticks, s->kernel_ticks,
+          s->voluntary_switches, s->involuntary_switches);
+  printf ("%s: %lld bytes read, %lld bytes written, "
+          "%u cache hits, %u cache misses, %lld lock wait ticks\n",
+          t->name, s->bytes_read, s->bytes_written,
+          s->cache_hits, s->cache_misses, s->lock_wait_ticks);
+}
+
+/* Sets the time slices from kernel command-line option SPEC,
+   of the form "SHORT:LONG": SHORT ticks at PRI_DEFAULT and above,
+   rising to LONG ticks at PRI_MIN.  A single number gives every
+   priority the same slice. */
+void
+thread_set_time_slices (const char *spec)
+{
+  const char *colon = strchr (spec, ':');
+  int short_slice = atoi (spec);
+  int long_slice = colon != NULL ? atoi (colon + 1) : short_slice;
+
+  if (short_slice <= 0 || long_slice < short_slice)
+    PANIC ("bad time slice specification \"%s\"", spec);
+  init_time_slices (short_slice, long_slice);
+}
+
+/* Fills in time_slice[] for a SHORT_SLICE at PRI_DEFAULT and
+   above growing to LONG_SLICE at PRI_MIN. */
+static void
+init_time_slices (unsigned short_slice, unsigned long_slice)
+{
+  int pri;
+
+  for (pri = PRI_MIN; pri <= PRI_MAX; pri++)
+    if (pri >= PRI_DEFAULT)
+      time_slice[pri] = short_slice;
+    else
+      time_slice[pri] = long_slice - (long_slice - short_slice)
+                                     * (pri - PRI_MIN) / (PRI_DEFAULT - PRI_MIN);
+}
+
+/* Returns the time slice for a thread at PRIORITY. */
+static unsigned
+thread_time_slice (int priority)
+{
+  if (priority < PRI_MIN)
+    priority = PRI_MIN;
+  else if (priority > PRI_MAX)
+    priority = PRI_MAX;
+  return time_slice[priority];
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -246,7 +403,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = alloc_thread_page ();
   if (t == NULL)
 	{
     return TID_ERROR;
@@ -261,6 +418,8 @@ thread_create (const char *name, int priority,
      member cannot be observed. */
   old_level = intr_disable ();
 
+  list_push_back (tid_bucket (thread_hash, tid), &t->tidelem);
+
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
   kf->eip = NULL;
@@ -307,6 +466,7 @@ thread_block (void)
   ASSERT (!intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
 
+  sched_trace_record (SCHED_BLOCK, thread_current ()->tid, 0, 0);
   thread_current ()->status = THREAD_BLOCKED;
   schedule ();
 }
@@ -334,6 +494,7 @@ thread_unblock (struct thread *t)
 	list_insert_ordered(&ready_list,&t->elem,compare_pri,(void*)NULL);
 	
 	t->status = THREAD_READY;
+	sched_trace_record (SCHED_UNBLOCK, t->tid, 0, t->priority);
 
 	intr_set_level (old_level);
 
@@ -341,6 +502,72 @@ thread_unblock (struct thread *t)
 
 
 
+/* Puts the current thread to sleep until timer tick WAKEUP_TICK.
+   timer_sleep() is built on this. */
+void
+thread_sleep (int64_t wakeup_tick)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (!intr_context ());
+  ASSERT (cur != idle_thread);
+
+  old_level = intr_disable ();
+  cur->wakeup_tick = wakeup_tick;
+  list_insert_ordered (&sleep_list, &cur->elem, compare_wakeup, NULL);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Returns the earliest tick at which a sleeping thread must be
+   woken, or INT64_MAX if no thread is sleeping.  Lets the timer
+   driver program its next one-shot interrupt for that deadline
+   instead of taking every tick while only sleepers remain. */
+int64_t
+thread_next_wakeup (void)
+{
+  int64_t next = INT64_MAX;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&sleep_list))
+    next = list_entry (list_front (&sleep_list), struct thread,
+                       elem)->wakeup_tick;
+  intr_set_level (old_level);
+  return next;
+}
+
+/* Unblocks every sleeping thread whose wakeup tick is at or
+   before NOW.  Called from the timer interrupt. */
+static void
+wake_sleepers (int64_t now)
+{
+  bool woke = false;
+
+  while (!list_empty (&sleep_list))
+    {
+      struct thread *t = list_entry (list_front (&sleep_list),
+                                     struct thread, elem);
+      if (t->wakeup_tick > now)
+        break;
+      list_pop_front (&sleep_list);
+      thread_unblock (t);
+      woke = true;
+    }
+  if (woke)
+    checkCurrentThreadPriority ();
+}
+
+/* Orders threads by ascending wakeup tick. */
+static bool
+compare_wakeup (const struct list_elem *e1, const struct list_elem *e2,
+                void *aux UNUSED)
+{
+  return list_entry (e1, struct thread, elem)->wakeup_tick
+         < list_entry (e2, struct thread, elem)->wakeup_tick;
+}
+
 bool 
 compare_pri(const struct list_elem *e1, const struct list_elem *e2, void *aux UNUSED)
 {
@@ -390,8 +617,12 @@ thread_exit (void)
 
 #ifdef USERPROG
 		process_exit ();
+		child_info_release (thread_current ());
 #endif
 
+  if (thread_acct)
+    thread_print_acct (thread_current ());
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it call schedule_tail(). */
@@ -401,6 +632,7 @@ thread_exit (void)
 //	printf("%s: exit(%d)\n",cur->name,getCIFromTid(cur->tid)->exitCode);
 //#endif
 	list_remove (&thread_current()->allelem);
+	list_remove (&thread_current()->tidelem);
 	thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -417,6 +649,7 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
+  sched_trace_record (SCHED_YIELD, cur->tid, 0, 0);
   if (cur != idle_thread) 
 	{
 		list_insert_ordered(&ready_list,&cur->elem,compare_pri,(void*)NULL);
@@ -572,6 +805,7 @@ thread_set_priority (int new_priority)
 	} else {
 		cur->oPriority = cur->priority = new_priority;
 	}
+	sched_trace_record (SCHED_PRIORITY, cur->tid, 0, cur->priority);
 	checkCurrentThreadPriority();
 
 }
@@ -738,6 +972,7 @@ init_thread (struct thread *t, const char *name, int priority)
   t->priority = t->oPriority = priority;		// modified
   t->magic = THREAD_MAGIC;
 	list_init(&t->donate_list);
+	list_init(&t->children);
   list_insert_ordered (&all_list, &t->allelem,compare_pri,(void *)NULL);
 }
 
@@ -808,10 +1043,34 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      if (list_size (&free_thread_pages) < THREAD_PAGE_CACHE_MAX)
+        list_push_front (&free_thread_pages, &prev->elem);
+      else
+        palloc_free_page (prev);
     }
 }
 
+/* Returns a page for a new thread, reusing the page of a dead
+   thread if one is available.  A reused page is not zeroed;
+   init_thread() clears the `struct thread' at its bottom and the
+   rest is stack.  Returns a null pointer if no page is
+   available. */
+static struct thread *
+alloc_thread_page (void)
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&free_thread_pages))
+    t = list_entry (list_pop_front (&free_thread_pages), struct thread, elem);
+  intr_set_level (old_level);
+
+  if (t == NULL)
+    t = palloc_get_page (PAL_ZERO);
+  return t;
+}
+
 /* Schedules a new process.  At entry, interrupts must be off and
    the running process's state must have been changed from
    running to some other state.  This function finds another
@@ -831,7 +1090,14 @@ schedule (void)
   ASSERT (is_thread (next));
 
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      if (cur->status == THREAD_READY)
+        cur->stats.involuntary_switches++;
+      else
+        cur->stats.voluntary_switches++;
+      sched_trace_record (SCHED_SWITCH, cur->tid, next->tid, cur->status);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev); 
 }
 
@@ -842,9 +1108,9 @@ allocate_tid (void)
   static tid_t next_tid = 1;
   tid_t tid;
 
-  lock_acquire (&tid_lock);
+  lockstat_acquire (&tid_lock);
   tid = next_tid++;
-  lock_release (&tid_lock);
+  lockstat_release (&tid_lock);
 
   return tid;
 }
@@ -853,22 +1119,25 @@ allocate_tid (void)
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
+/* Returns the bucket of hash TABLE that holds TID. */
+static struct list *
+tid_bucket (struct list *table, tid_t tid)
+{
+  return &table[(unsigned) tid % TID_HASH_SIZE];
+}
+
 struct thread*
 getThreadFromTid(tid_t tid)
-
 {
-	struct list_elem *e = list_begin(&all_list);
-	struct thread *result = NULL;
-	for(;e!=list_end(&all_list);e=list_next(e))
+	struct list *bucket = tid_bucket(thread_hash, tid);
+	struct list_elem *e;
+	for(e = list_begin(bucket);e != list_end(bucket);e = list_next(e))
 	{
-		struct thread *t = list_entry(e,struct thread,allelem);
+		struct thread *t = list_entry(e,struct thread,tidelem);
 		if(tid == t->tid)
-		{
-			result = t;
-			break;
-		}
+			return t;
 	}
-	return result;
+	return NULL;
 }
 
 // -- fixed point functions
@@ -929,11 +1198,30 @@ int divxn(int x, int n)
 	return x/n;
 }
 
+/* Returns the child_info record for TID entered with
+   child_info_add(), or a null pointer if there is none. */
+static struct child_info*
+child_info_lookup(tid_t tid)
+{
+	struct list *bucket = tid_bucket(child_info_hash, tid);
+	struct list_elem *e;
+	struct child_info *ci;
+	for(e = list_begin(bucket);e != list_end(bucket);e = list_next(e))
+	{
+		ci = list_entry(e,struct child_info,tidelem);
+		if (ci->tid == tid)
+			return ci;
+	}
+	return NULL;
+}
+
 struct child_info*  
 getCIFromTid(tid_t tid)
 {
 	struct list_elem *e;
-	struct child_info *ci;
+	struct child_info *ci = child_info_lookup(tid);
+	if (ci != NULL)
+		return ci;
 	for(e = list_begin(&child_info_list);e != list_end(&child_info_list);e = list_next(e))
 	{
 		ci = list_entry(e,struct child_info,elem);
@@ -943,6 +1231,56 @@ getCIFromTid(tid_t tid)
 	return NULL;
 }
 
+#ifdef USERPROG
+/* Registers CI, whose tid and parent must already be set, in the
+   child_info hash table and on its parent's children list. */
+void
+child_info_add(struct child_info *ci)
+{
+	ASSERT(ci->parent != NULL);
+
+	lock_acquire(&child_lock);
+	ci->exited = false;
+	list_push_back(tid_bucket(child_info_hash, ci->tid), &ci->tidelem);
+	list_push_back(&ci->parent->children, &ci->elem);
+	lock_release(&child_lock);
+}
+
+/* Called as T exits.  Frees the records of T's children that have
+   already exited and orphans the rest, which then free their own
+   records when they exit.  Also frees T's own record if T's
+   parent is already gone. */
+static void
+child_info_release(struct thread *t)
+{
+	struct child_info *ci;
+
+	lock_acquire(&child_lock);
+	while(!list_empty(&t->children))
+	{
+		ci = list_entry(list_pop_front(&t->children),struct child_info,elem);
+		if(ci->exited)
+		{
+			list_remove(&ci->tidelem);
+			free(ci);
+		}
+		else ci->parent = NULL;
+	}
+
+	ci = child_info_lookup(t->tid);
+	if(ci != NULL)
+	{
+		ci->exited = true;
+		if(ci->parent == NULL)
+		{
+			list_remove(&ci->tidelem);
+			free(ci);
+		}
+	}
+	lock_release(&child_lock);
+}
+#endif
+
 bool checkIsThread(char* filename)
 {
 	struct list_elem *e;
@@ -978,5 +1316,3 @@ dir_is_pwd (struct dir* dir)
   }
   return false;
 }
-
-
@@ -29,6 +29,21 @@ struct thread;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Per-thread resource accounting, reported at exit when
+   thread_acct is set and returned by the procstat system call. */
+struct thread_stats
+  {
+    long long user_ticks;               /* Timer ticks in user mode. */
+    long long kernel_ticks;             /* Timer ticks in kernel mode. */
+    unsigned voluntary_switches;        /* Switches away while blocking. */
+    unsigned involuntary_switches;      /* Switches away while runnable. */
+    long long bytes_read;               /* File bytes returned by read. */
+    long long bytes_written;            /* File bytes accepted by write. */
+    unsigned cache_hits;                /* Buffer cache hits. */
+    unsigned cache_misses;              /* Buffer cache misses. */
+    long long lock_wait_ticks;          /* Ticks waiting in lockstat_acquire(). */
+  };
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -94,7 +109,10 @@ struct thread
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
     int priority;                       /* Priority. */
+    int64_t wakeup_tick;                /* Tick to wake at, if sleeping. */
+    struct thread_stats stats;          /* Resource accounting. */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct list_elem tidelem;           /* List element for tid hash table. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
@@ -107,6 +125,7 @@ struct thread
 
 #ifdef FILESYS
     struct dir* pwd;
+    int journal_depth;                  /* Nesting of journal_begin(). */
 #endif
 
     /* Owned by thread.c. */
@@ -123,6 +142,7 @@ struct thread
 		// project2
 		struct child_info *Info;
 		struct file* e_file;
+		struct list children;		// child_info of our children
 };
 
 struct donate
@@ -135,27 +155,39 @@ struct donate
 struct child_info
 {
 	struct thread *parent;
-	struct list_elem elem;
+	struct list_elem elem;		// element in parent's children list
+	struct list_elem tidelem;	// element in child_info hash table
 	struct semaphore w_sema;
 	struct semaphore e_sema;
 	tid_t tid;
 	int exitCode;
 	bool alreadyWait;
 	bool loadFail;
+	bool exited;
 };
 
 struct child_info* getCIFromTid(tid_t tid);
+#ifdef USERPROG
+void child_info_add(struct child_info *ci);
+#endif
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, print each thread's accounting when it exits.
+   Controlled by kernel command-line option "-o acct". */
+extern bool thread_acct;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
+void thread_tick_overhead (uint64_t *cycles, int64_t *cnt);
 void thread_print_stats (void);
+void thread_print_acct (struct thread *);
+void thread_set_time_slices (const char *spec);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -163,6 +195,9 @@ tid_t thread_create (const char *name, int priority, thread_func *, void *);
 void thread_block (void);
 void thread_unblock (struct thread *);
 
+void thread_sleep (int64_t wakeup_tick);
+int64_t thread_next_wakeup (void);
+
 struct thread *thread_current (void);
 tid_t thread_tid (void);
 const char *thread_name (void);
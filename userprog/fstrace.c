@@ -0,0 +1,535 @@
+#include "userprog/fstrace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "filesys/directory.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "devices/timer.h"
+
+/* File system call trace.
+
+   While enabled, every file system call made by a user process
+   is appended to an in-memory buffer as a struct fstrace_record
+   followed by its path name argument, if any.  The buffer is
+   written to FSTRACE_FILE by filesys_done(), so that it can be
+   copied out with "pintos -g" and replayed later, against a
+   freshly formatted file system, by fstrace_replay().
+
+   Console reads and writes are not recorded.  Records that do
+   not fit in the buffer are counted and dropped. */
+
+/* Size of the trace buffer, in pages. */
+#define FSTRACE_PAGES 64
+#define FSTRACE_SIZE (FSTRACE_PAGES * PGSIZE)
+
+/* Longest path name recorded; longer names are truncated. */
+#define FSTRACE_NAME_MAX 255
+
+/* If true, file system calls are recorded.
+   Controlled by kernel command-line option "-o fstrace". */
+bool fstrace_enabled;
+
+static struct lock fstrace_lock;        /* Protects the members below. */
+static uint8_t *trace_buf;              /* Trace buffer, or null. */
+static size_t trace_used;               /* Bytes used in trace_buf. */
+static uint32_t record_cnt;             /* Records in trace_buf. */
+static uint32_t dropped_cnt;            /* Records dropped. */
+
+/* Initializes the trace.  The buffer itself is not allocated
+   until the first record. */
+void
+fstrace_init (void)
+{
+  lock_init (&fstrace_lock);
+}
+
+/* Copies the user string at UNAME, up to FSTRACE_NAME_MAX bytes,
+   into NAME and returns its length.  Returns 0 if UNAME is null
+   or any byte of it lies outside mapped user memory. */
+static size_t
+copy_user_name (const char *uname, char *name)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  size_t len;
+
+  if (uname == NULL)
+    return 0;
+  for (len = 0; len < FSTRACE_NAME_MAX; len++)
+    {
+      const char *p = uname + len;
+
+      if (!is_user_vaddr (p))
+        return 0;
+      if ((len == 0 || pg_ofs (p) == 0)
+          && pagedir_get_page (pd, p) == NULL)
+        return 0;
+      if (*p == '\0')
+        break;
+      name[len] = *p;
+    }
+  return len;
+}
+
+/* Records file system call NR, which has just completed with
+   frame F, if tracing is enabled.  Other system calls are
+   ignored. */
+void
+fstrace_syscall (int nr, struct intr_frame *f)
+{
+  const int32_t *argv = (const int32_t *) f->esp + 1;
+  const char *uname = NULL;
+  char name[FSTRACE_NAME_MAX];
+  struct fstrace_record r;
+  bool has_result = true;
+  size_t size;
+
+  if (!fstrace_enabled)
+    return;
+
+  memset (&r, 0, sizeof r);
+  switch (nr)
+    {
+    case SYS_CREATE:
+      uname = (const char *) (uintptr_t) argv[0];
+      r.args[1] = argv[1];
+      break;
+    case SYS_REMOVE:
+    case SYS_OPEN:
+    case SYS_CHDIR:
+    case SYS_MKDIR:
+      uname = (const char *) (uintptr_t) argv[0];
+      break;
+    case SYS_READ:
+    case SYS_WRITE:
+      if (argv[0] == STDIN_FILENO || argv[0] == STDOUT_FILENO)
+        return;
+      r.args[0] = argv[0];
+      r.args[2] = argv[2];
+      break;
+    case SYS_SEEK:
+      has_result = false;
+      r.args[0] = argv[0];
+      r.args[1] = argv[1];
+      break;
+    case SYS_CLOSE:
+      has_result = false;
+      r.args[0] = argv[0];
+      break;
+    case SYS_FILESIZE:
+    case SYS_TELL:
+    case SYS_READDIR:
+    case SYS_ISDIR:
+    case SYS_INUMBER:
+      r.args[0] = argv[0];
+      break;
+    default:
+      return;
+    }
+
+  r.tick = timer_ticks ();
+  r.pid = thread_current ()->tid;
+  r.nr = nr;
+  r.name_len = copy_user_name (uname, name);
+  r.result = has_result ? (int32_t) f->eax : 0;
+  size = sizeof r + ROUND_UP (r.name_len, 4);
+
+  lock_acquire (&fstrace_lock);
+  if (trace_buf == NULL)
+    trace_buf = palloc_get_multiple (0, FSTRACE_PAGES);
+  if (trace_buf != NULL && trace_used + size <= FSTRACE_SIZE)
+    {
+      memcpy (trace_buf + trace_used, &r, sizeof r);
+      memcpy (trace_buf + trace_used + sizeof r, name, r.name_len);
+      trace_used += size;
+      record_cnt++;
+    }
+  else
+    dropped_cnt++;
+  lock_release (&fstrace_lock);
+}
+
+/* Writes the trace to FSTRACE_FILE in the root directory,
+   replacing any existing file, and stops tracing. */
+void
+fstrace_save (void)
+{
+  struct fstrace_header h;
+  struct file *file;
+
+  if (!fstrace_enabled)
+    return;
+  fstrace_enabled = false;
+
+  h.magic = FSTRACE_MAGIC;
+  h.record_cnt = record_cnt;
+  h.dropped = dropped_cnt;
+  h.size = trace_used;
+
+  path = NULL;
+  filesys_remove (FSTRACE_FILE);
+  path = NULL;
+  file = NULL;
+  if (filesys_create (FSTRACE_FILE, 0))
+    {
+      path = NULL;
+      file = filesys_open (FSTRACE_FILE);
+    }
+  if (file == NULL
+      || file_write (file, &h, sizeof h) != sizeof h
+      || file_write (file, trace_buf, trace_used) != (off_t) trace_used)
+    printf ("fstrace: failed to save trace\n");
+  else
+    printf ("fstrace: saved %"PRIu32" records (%"PRIu32" dropped) "
+            "in \"%s\"\n", record_cnt, dropped_cnt, FSTRACE_FILE);
+  file_close (file);
+
+  if (trace_buf != NULL)
+    palloc_free_multiple (trace_buf, FSTRACE_PAGES);
+  trace_buf = NULL;
+}
+
+/* Replay state.  Each traced process is mapped to a current
+   directory and a table from the file descriptors it saw to the
+   files opened on its behalf during replay. */
+#define REPLAY_PROCS 16
+#define REPLAY_FILES 64
+
+struct replay_file
+  {
+    int fd;                     /* Recorded descriptor, or 0 if free. */
+    struct file *file;          /* File opened by replay. */
+  };
+
+struct replay_proc
+  {
+    int pid;                    /* Recorded process, or 0 if free. */
+    struct dir *cwd;            /* Current directory. */
+    struct replay_file files[REPLAY_FILES];
+  };
+
+static struct replay_proc *replay_procs;
+static uint8_t *replay_data;    /* Data read and written. */
+
+static bool replay_check (const struct fstrace_header *,
+                          const uint8_t *records);
+static struct replay_proc *replay_get_proc (int pid);
+static struct replay_file *replay_get_file (struct replay_proc *, int fd);
+static bool replay_record (const struct fstrace_record *, char *name,
+                           int32_t *result);
+static bool replay_chdir (struct replay_proc *, char *name);
+static int32_t replay_rw (struct file *, int32_t size, bool write);
+
+/* Re-executes the trace in FILE_NAME against the file system,
+   reporting any call whose result differs from the recorded
+   one.  Meant to be run on a freshly formatted file system
+   holding only the trace. */
+void
+fstrace_replay (const char *file_name)
+{
+  struct fstrace_header h;
+  struct file *file;
+  uint8_t *records = NULL;
+  char *name;
+  uint32_t i, replayed = 0, skipped = 0, mismatched = 0;
+  size_t ofs;
+  int64_t start;
+
+  path = NULL;
+  file = filesys_open (file_name);
+  if (file == NULL)
+    {
+      printf ("fsreplay: %s: open failed\n", file_name);
+      return;
+    }
+  if (file_read (file, &h, sizeof h) != sizeof h || h.magic != FSTRACE_MAGIC
+      || (records = malloc (h.size)) == NULL
+      || file_read (file, records, h.size) != (off_t) h.size
+      || !replay_check (&h, records))
+    {
+      printf ("fsreplay: %s: not a readable trace\n", file_name);
+      file_close (file);
+      free (records);
+      return;
+    }
+  file_close (file);
+  if (h.dropped > 0)
+    printf ("fsreplay: warning: %"PRIu32" records were dropped "
+            "while tracing\n", h.dropped);
+
+  replay_procs = calloc (REPLAY_PROCS, sizeof *replay_procs);
+  replay_data = palloc_get_page (PAL_ZERO);
+  name = palloc_get_page (0);
+  if (replay_procs == NULL || replay_data == NULL || name == NULL)
+    PANIC ("fsreplay: out of memory");
+
+  start = timer_ticks ();
+  for (i = 0, ofs = 0; i < h.record_cnt; i++)
+    {
+      struct fstrace_record r;
+      int32_t result;
+
+      memcpy (&r, records + ofs, sizeof r);
+      memcpy (name, records + ofs + sizeof r, r.name_len);
+      name[r.name_len] = '\0';
+      ofs += sizeof r + ROUND_UP (r.name_len, 4);
+
+      if (!replay_record (&r, name, &result))
+        skipped++;
+      else
+        {
+          replayed++;
+          if (result != r.result && mismatched++ < 10)
+            printf ("fsreplay: record %"PRIu32": pid %"PRId32" call %d "
+                    "\"%s\" returned %"PRId32", recorded %"PRId32"\n",
+                    i, r.pid, r.nr, name, result, r.result);
+        }
+    }
+
+  printf ("fsreplay: %"PRIu32" calls replayed, %"PRIu32" skipped, "
+          "%"PRIu32" mismatched, in %"PRId64" ticks\n",
+          replayed, skipped, mismatched, timer_elapsed (start));
+
+  for (i = 0; i < REPLAY_PROCS; i++)
+    {
+      struct replay_proc *p = &replay_procs[i];
+      int j;
+
+      if (p->pid == 0)
+        continue;
+      for (j = 0; j < REPLAY_FILES; j++)
+        if (p->files[j].fd != 0)
+          file_close_user (p->files[j].file);
+      dir_close (p->cwd);
+    }
+  palloc_free_page (name);
+  palloc_free_page (replay_data);
+  free (replay_procs);
+  free (records);
+}
+
+/* Returns true if the H->record_cnt records in RECORDS, H->size
+   bytes long, are well formed: each lies within RECORDS and has
+   a path name of at most FSTRACE_NAME_MAX bytes. */
+static bool
+replay_check (const struct fstrace_header *h, const uint8_t *records)
+{
+  size_t ofs = 0;
+  uint32_t i;
+
+  for (i = 0; i < h->record_cnt; i++)
+    {
+      struct fstrace_record r;
+
+      if (h->size - ofs < sizeof r)
+        return false;
+      memcpy (&r, records + ofs, sizeof r);
+      if (r.name_len > FSTRACE_NAME_MAX
+          || h->size - ofs - sizeof r < ROUND_UP (r.name_len, 4))
+        return false;
+      ofs += sizeof r + ROUND_UP (r.name_len, 4);
+    }
+  return true;
+}
+
+/* Re-executes record R, whose path name argument is NAME,
+   storing its return value in *RESULT.  Open is reported as
+   returning the recorded descriptor on success.  Returns false
+   if R could not be replayed. */
+static bool
+replay_record (const struct fstrace_record *r, char *name, int32_t *result)
+{
+  struct replay_proc *p = replay_get_proc (r->pid);
+  struct replay_file *rf = NULL;
+  struct file *file;
+
+  if (p == NULL)
+    return false;
+
+  switch (r->nr)
+    {
+    case SYS_FILESIZE:
+    case SYS_READ:
+    case SYS_WRITE:
+    case SYS_SEEK:
+    case SYS_TELL:
+    case SYS_CLOSE:
+      rf = replay_get_file (p, r->args[0]);
+      if (rf == NULL || rf->fd == 0)
+        {
+          /* Unknown descriptor: the recorded call failed too,
+             unless the trace is incomplete. */
+          *result = r->nr == SYS_SEEK || r->nr == SYS_CLOSE ? 0 : -1;
+          return true;
+        }
+      break;
+    }
+
+  path = p->cwd;
+  switch (r->nr)
+    {
+    case SYS_CREATE:
+      *result = name[0] != '\0' && filesys_create (name, r->args[1]);
+      break;
+    case SYS_REMOVE:
+      *result = filesys_remove (name);
+      break;
+    case SYS_OPEN:
+      file = name[0] != '\0' ? filesys_open (name) : NULL;
+      rf = r->result >= 0 ? replay_get_file (p, r->result) : NULL;
+      if (file == NULL)
+        *result = -1;
+      else if (rf == NULL)
+        {
+          /* Recorded open failed, or too many files. */
+          file_close (file);
+          *result = 0;
+        }
+      else
+        {
+          if (rf->fd != 0)
+            file_close_user (rf->file);
+          rf->fd = r->result;
+          rf->file = file;
+          *result = r->result;
+        }
+      break;
+    case SYS_FILESIZE:
+      *result = file_length (rf->file);
+      break;
+    case SYS_READ:
+    case SYS_WRITE:
+      *result = replay_rw (rf->file, r->args[2], r->nr == SYS_WRITE);
+      break;
+    case SYS_SEEK:
+      file_seek (rf->file, r->args[1]);
+      *result = 0;
+      break;
+    case SYS_TELL:
+      *result = file_tell (rf->file);
+      break;
+    case SYS_CLOSE:
+      file_close_user (rf->file);
+      rf->fd = 0;
+      *result = 0;
+      break;
+    case SYS_MKDIR:
+      *result = mkdir_by_name (name, p->cwd);
+      break;
+    case SYS_CHDIR:
+      *result = replay_chdir (p, name);
+      break;
+    default:
+      return false;
+    }
+  return true;
+}
+
+/* Changes P's current directory to NAME, the way the chdir
+   system call does.  Returns true if successful. */
+static bool
+replay_chdir (struct replay_proc *p, char *name)
+{
+  struct inode *inode;
+  char *name_copy;
+  bool success = false;
+
+  if (strcmp (name, "/") == 0)
+    {
+      dir_close (p->cwd);
+      p->cwd = dir_open_root ();
+      return true;
+    }
+
+  name_copy = palloc_get_page (0);
+  if (name_copy == NULL)
+    return false;
+  find_dir (name, name_copy, dir_reopen (p->cwd));
+  if (path != NULL && dir_lookup (path, name_copy, &inode))
+    {
+      if (isdir_by_name (path, name_copy))
+        {
+          dir_close (p->cwd);
+          p->cwd = dir_open (inode);
+          success = true;
+        }
+      else
+        inode_close (inode);
+    }
+  palloc_free_page (name_copy);
+  return success;
+}
+
+/* Reads or writes SIZE bytes at FILE's position, a page at a
+   time, following the read and write system calls in returning
+   0 at end of file.  Returns the number of bytes transferred. */
+static int32_t
+replay_rw (struct file *file, int32_t size, bool write)
+{
+  int32_t done = 0;
+
+  if (file_tell (file) >= file_length (file))
+    return 0;
+  while (done < size)
+    {
+      off_t chunk = size - done < PGSIZE ? size - done : PGSIZE;
+      off_t cnt = (write
+                   ? file_write_user (file, replay_data, chunk)
+                   : file_read_user (file, replay_data, chunk));
+      if (cnt <= 0)
+        break;
+      done += cnt;
+      if (cnt < chunk)
+        break;
+    }
+  return done;
+}
+
+/* Returns the replay state for recorded process PID, creating
+   it in the root directory if necessary.  Returns a null pointer
+   if there are too many processes. */
+static struct replay_proc *
+replay_get_proc (int pid)
+{
+  struct replay_proc *free_proc = NULL;
+  int i;
+
+  for (i = 0; i < REPLAY_PROCS; i++)
+    if (replay_procs[i].pid == pid)
+      return &replay_procs[i];
+    else if (replay_procs[i].pid == 0 && free_proc == NULL)
+      free_proc = &replay_procs[i];
+
+  if (free_proc != NULL)
+    {
+      free_proc->pid = pid;
+      free_proc->cwd = dir_open_root ();
+    }
+  return free_proc;
+}
+
+/* Returns P's entry for recorded descriptor FD, or a free entry
+   if FD is not open, or a null pointer if the table is full. */
+static struct replay_file *
+replay_get_file (struct replay_proc *p, int fd)
+{
+  struct replay_file *free_file = NULL;
+  int i;
+
+  for (i = 0; i < REPLAY_FILES; i++)
+    if (p->files[i].fd == fd)
+      return &p->files[i];
+    else if (p->files[i].fd == 0 && free_file == NULL)
+      free_file = &p->files[i];
+  return free_file;
+}
@@ -0,0 +1,45 @@
+#ifndef USERPROG_FSTRACE_H
+#define USERPROG_FSTRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+
+/* Trace file written at shutdown, in the root directory. */
+#define FSTRACE_FILE "fstrace"
+
+/* Identifies a trace file. */
+#define FSTRACE_MAGIC 0x52545346        /* "FSTR". */
+
+/* Start of a trace file. */
+struct fstrace_header
+  {
+    uint32_t magic;             /* FSTRACE_MAGIC. */
+    uint32_t record_cnt;        /* Number of records that follow. */
+    uint32_t dropped;           /* Records lost to a full buffer. */
+    uint32_t size;              /* Bytes of records that follow. */
+  };
+
+/* One traced system call.  Followed by NAME_LEN bytes of path
+   name, not null-terminated, then padding to a multiple of 4
+   bytes. */
+struct fstrace_record
+  {
+    int64_t tick;               /* Timer tick at completion. */
+    int32_t pid;                /* Calling process. */
+    uint16_t nr;                /* System call number. */
+    uint16_t name_len;          /* Length of path name argument. */
+    int32_t args[3];            /* Arguments; pointers recorded as 0. */
+    int32_t result;             /* Return value, or 0 if none. */
+  };
+
+/* If true, file system calls are recorded.
+   Controlled by kernel command-line option "-o fstrace". */
+extern bool fstrace_enabled;
+
+void fstrace_init (void);
+void fstrace_syscall (int nr, struct intr_frame *);
+void fstrace_save (void);
+void fstrace_replay (const char *file_name);
+
+#endif /* userprog/fstrace.h */
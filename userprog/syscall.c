@@ -5,9 +5,17 @@
 #include "threads/thread.h"
 #include "threads/init.h"
 #include <string.h>
+#include "threads/lockstat.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/vaddr.h"
+#include "threads/schedtrace.h"
+#include "userprog/fstrace.h"
+#include "userprog/pagedir.h"
 
 #include "filesys/file.h"
+#include "filesys/iosched.h"
 #include "devices/input.h"
 
 #define checkARG 	if((uint32_t)esp > 0xc0000000-(argsNum+1)*4) \
@@ -15,6 +23,7 @@
 
 static void syscall_handler (struct intr_frame *);
 static struct list fd_list;
+static struct slab_cache fd_elem_cache;
 
 //struct lock FILELOCK;
 
@@ -49,12 +58,39 @@ struct file* getFile(int fd, struct thread *cur)
 	return result;
 }
 
+/* Acquires FILELOCK unless the running thread already holds it,
+   as it does when a file system call ends up extending a
+   directory.  Returns true if FILELOCK was acquired here, in
+   which case the caller passes true to filelock_release().
+
+   FILELOCK is always taken before a journal handle is opened,
+   never inside one, since its holders open handles of their own. */
+bool
+filelock_acquire (void)
+{
+  if (lock_held_by_current_thread (&FILELOCK))
+    return false;
+  lockstat_acquire (&FILELOCK);
+  return true;
+}
+
+/* Releases FILELOCK if ACQUIRED, the value returned by the
+   matching filelock_acquire(). */
+void
+filelock_release (bool acquired)
+{
+  if (acquired)
+    lockstat_release (&FILELOCK);
+}
+
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 	list_init(&fd_list);
-	lock_init(&FILELOCK);
+	lock_init_named(&FILELOCK, "FILELOCK");
+	slab_cache_init(&fd_elem_cache, "fd_elem", sizeof(struct fd_elem), NULL);
+	fstrace_init();
 }
 
 static void
@@ -99,8 +135,16 @@ syscall_handler (struct intr_frame *f)
                 break;
                 case SYS_INUMBER: syscall_inumber(f, 1);
                 break;
+                case SYS_PROCSTAT: syscall_procstat(f, 2);
+                break;
+                case SYS_SCHEDTRACE: syscall_schedtrace(f, 2);
+                break;
+                case SYS_IOSTAT: syscall_iostat(f, 1);
+                break;
 
 	}	
+	if(fstrace_enabled)
+		fstrace_syscall(syscall_num, f);
 }
 
 
@@ -120,7 +164,7 @@ void allClose(struct thread *cur)
 			file_close_user(fe->file);
 			list_remove(e);	
 			e=list_prev(e);
-			free(fe);
+			slab_free(&fd_elem_cache, fe);
 
 		}
 	}
@@ -147,10 +191,10 @@ void syscall_exit(struct intr_frame *f,int argsNum)
 	}
 	
 	if(FILELOCK.holder != cur)
-	lock_acquire(&FILELOCK);
+	lockstat_acquire(&FILELOCK);
 	allClose(cur);
 	if(FILELOCK.holder == cur)
-	lock_release(&FILELOCK);
+	lockstat_release(&FILELOCK);
 
 	printf("%s: exit(%d)\n",cur->name,status);
 	
@@ -186,6 +230,13 @@ path = dir_reopen(thread_current ()->pwd);
 
 	struct child_info * ci = getCIFromTid(tid);
 
+	/* No record to wait on, so the load result is unknown. */
+	if(ci == NULL)
+	{
+		f->eax = tid;
+		return;
+	}
+
 	sema_down(&ci->e_sema);
 	
 	if(ci->loadFail)
@@ -221,11 +272,11 @@ void syscall_create(struct intr_frame *f,int argsNum){
 		f->eax = 0;
 		return;
 	}
-	lock_acquire(&FILELOCK);
+	lockstat_acquire(&FILELOCK);
 path = dir_reopen(thread_current ()->pwd);
 	bool result = filesys_create(file,initial_size);
 
-	lock_release(&FILELOCK);
+	lockstat_release(&FILELOCK);
 	f->eax = (int)result;
 }
 void syscall_remove(struct intr_frame *f,int argsNum){
@@ -235,10 +286,10 @@ void syscall_remove(struct intr_frame *f,int argsNum){
 
 	char* file = *(char **)(esp+4);
 	
-	lock_acquire(&FILELOCK);
+	lockstat_acquire(&FILELOCK);
 path = dir_reopen(thread_current ()->pwd);
 	bool result = filesys_remove(file);
-	lock_release(&FILELOCK);
+	lockstat_release(&FILELOCK);
 	f->eax = (int)result;
 
 }
@@ -258,12 +309,12 @@ void syscall_open(struct intr_frame *f,int argsNum){
 
 	struct thread *cur = thread_current();
 	
-	lock_acquire(&FILELOCK);
+	lockstat_acquire(&FILELOCK);
         path = dir_reopen(thread_current ()->pwd);
 	struct file* file = filesys_open(filename);
 
 	if(file != NULL){
-		struct fd_elem *fe = (struct fd_elem *)malloc(sizeof(struct fd_elem));
+		struct fd_elem *fe = (struct fd_elem *)slab_alloc(&fd_elem_cache);
 	
 		fe->owner = cur;
 		fe->file = file;
@@ -283,7 +334,7 @@ void syscall_open(struct intr_frame *f,int argsNum){
 		f->eax = fe->fd;
 	} else f->eax = -1;
   dir_close (path);
-	lock_release(&FILELOCK);
+	lockstat_release(&FILELOCK);
 }
 
 void syscall_filesize(struct intr_frame *f,int argsNum){
@@ -293,12 +344,12 @@ void syscall_filesize(struct intr_frame *f,int argsNum){
 	
 	int fd = *(int *)(esp+4);
 
-	lock_acquire(&FILELOCK);
+	lockstat_acquire(&FILELOCK);
 	struct file *file = getFile(fd,thread_current());
 	if(file != NULL)
 		f->eax = file_length(file);
 	else f->eax = -1;
-	lock_release(&FILELOCK);
+	lockstat_release(&FILELOCK);
 }
 
 void syscall_read(struct intr_frame *f,int argsNum){
@@ -328,6 +379,8 @@ void syscall_read(struct intr_frame *f,int argsNum){
 			if(file_tell(file) >= file_length(file))
 				f->eax = 0;
 			else f->eax = file_read_user(file,buffer,size);
+			if((int)f->eax > 0)
+				thread_current()->stats.bytes_read += (int)f->eax;
 		}
 		else f->eax = -1;
 	}
@@ -357,6 +410,8 @@ void syscall_write (struct intr_frame *f,int argsNum)
 			if(file_tell(file) >= file_length(file))	// EOF
 				f->eax = 0;
 			else f->eax = file_write_user(file,buffer,size);
+			if((int)f->eax > 0)
+				thread_current()->stats.bytes_written += (int)f->eax;
 		}
 		else f->eax = -1;
 	}
@@ -372,14 +427,14 @@ void syscall_seek(struct intr_frame *f,int argsNum){
 	int fd = *(int *)(esp+4);
 	uint32_t position = *(uint32_t *)(esp+8);
 
-	lock_acquire(&FILELOCK);
+	lockstat_acquire(&FILELOCK);
 	struct file *file = getFile(fd,thread_current());
 	if(file != NULL)
 	{
 		file_seek(file,position);		
 	}
 
-	lock_release(&FILELOCK);
+	lockstat_release(&FILELOCK);
 }
 void syscall_tell(struct intr_frame *f,int argsNum){
 	void*esp = f->esp;
@@ -387,13 +442,13 @@ void syscall_tell(struct intr_frame *f,int argsNum){
 
 	int fd = *(int *)(esp+4);
 
-	lock_acquire(&FILELOCK);
+	lockstat_acquire(&FILELOCK);
 	struct file *file = getFile(fd,thread_current());
 	if(file != NULL)
 	{
 		f->eax = file_tell(file);
 	} else f->eax = -1;
-	lock_release(&FILELOCK);
+	lockstat_release(&FILELOCK);
 	
 }
 
@@ -406,7 +461,7 @@ void elemFile(struct file *file)
 		if(fe->file == file && fe->owner == thread_current())
 		{
 			list_remove(e);
-			free(fe);
+			slab_free(&fd_elem_cache, fe);
 			return;
 		}
 	}
@@ -421,13 +476,13 @@ void syscall_close(struct intr_frame *f,int argsNum){
 
 	struct thread* cur = thread_current();
 	struct file *file = getFile(fd,cur);
-	lock_acquire(&FILELOCK);
+	lockstat_acquire(&FILELOCK);
 	if(file != NULL)
 	{
 		file_close_user(file);
 		elemFile(file);
 	}
-	lock_release(&FILELOCK);
+	lockstat_release(&FILELOCK);
 }
 
 void syscall_chdir(struct intr_frame *f, int argsNum){
@@ -437,7 +492,7 @@ void syscall_chdir(struct intr_frame *f, int argsNum){
         char *filename = *(char **)(esp+4);
         char *fn_copy;
         fn_copy = palloc_get_page (0);
-        lock_acquire(&FILELOCK);
+        lockstat_acquire(&FILELOCK);
 if(strcmp (filename, "/")==0)
 {
   thread_current ()->pwd = dir_open_root ();
@@ -466,16 +521,16 @@ else
         }
 }
         palloc_free_page (fn_copy);
-        lock_release (&FILELOCK);
+        lockstat_release(&FILELOCK);
 }
 
 void syscall_mkdir(struct intr_frame *f, int argsNum){
         void *esp = f->esp;
         checkARG
         char *filename = *(char **)(esp+4);
-        lock_acquire (&FILELOCK);
+        lockstat_acquire(&FILELOCK);
         f->eax = mkdir_by_name (filename, thread_current ()->pwd);
-        lock_release (&FILELOCK);
+        lockstat_release(&FILELOCK);
 }
 
 void syscall_readdir(struct intr_frame *f, int argsNum){
@@ -545,6 +600,96 @@ void syscall_inumber (struct intr_frame *f, int argsNum){
           f->eax = file_get_inode (file);
 }
 
+/* Returns true if the SIZE bytes at user address BUFFER are all
+   mapped user memory, false if BUFFER is null or any part of it
+   is in the kernel or unmapped. */
+static bool
+user_buffer_ok (const void *buffer, size_t size)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+  const uint8_t *start = buffer;
+  const uint8_t *page;
+
+  if (start == NULL)
+    return false;
+  if (size == 0)
+    return is_user_vaddr (start);
+  if (start + size < start || !is_user_vaddr (start + size - 1))
+    return false;
+  for (page = pg_round_down (start); page < start + size; page += PGSIZE)
+    if (pagedir_get_page (pd, page) == NULL)
+      return false;
+  return true;
+}
+
+/* procstat (tid, stats): copies the accounting of thread TID, or
+   of the caller if TID is -1, into STATS.  Returns false if there
+   is no such thread. */
+void syscall_procstat (struct intr_frame *f, int argsNum){
+        void *esp = f->esp;
+        checkARG
+        tid_t tid = *(tid_t *)(esp+4);
+        struct thread_stats *buf = *(struct thread_stats **)(esp+8);
+        struct thread_stats stats;
+        struct thread *t;
+        enum intr_level old_level;
+
+        if(!user_buffer_ok(buf, sizeof *buf)) syscall_exit(f,-1);
+
+        old_level = intr_disable ();
+        t = tid == -1 ? thread_current () : getThreadFromTid (tid);
+        if (t != NULL)
+          stats = t->stats;
+        intr_set_level (old_level);
+
+        if (t != NULL)
+          *buf = stats;
+        f->eax = t != NULL;
+}
+
+/* schedtrace (events, max_cnt): copies up to MAX_CNT of the most
+   recent scheduler events, oldest first, into EVENTS.  At most a
+   page worth of events is copied per call.  Returns the number
+   copied, or -1 if out of memory. */
+void syscall_schedtrace (struct intr_frame *f, int argsNum){
+        void *esp = f->esp;
+        checkARG
+        struct sched_event *buf = *(struct sched_event **)(esp+4);
+        size_t max_cnt = *(size_t *)(esp+8);
+        struct sched_event *events;
+        size_t cnt;
+
+        if (max_cnt > PGSIZE / sizeof *events)
+          max_cnt = PGSIZE / sizeof *events;
+        if(!user_buffer_ok(buf, max_cnt * sizeof *buf)) syscall_exit(f,-1);
+
+        events = palloc_get_page (0);
+        if (events == NULL)
+        {
+          f->eax = -1;
+          return;
+        }
+        cnt = sched_trace_copy (events, max_cnt);
+        memcpy (buf, events, cnt * sizeof *events);
+        palloc_free_page (events);
+        f->eax = cnt;
+}
+
+/* iostat (stats): copies the file system device's statistics
+   into STATS. */
+void syscall_iostat (struct intr_frame *f, int argsNum){
+        void *esp = f->esp;
+        checkARG
+        struct io_stats *buf = *(struct io_stats **)(esp+4);
+        struct io_stats stats;
+
+        if(!user_buffer_ok(buf, sizeof *buf)) syscall_exit(f,-1);
+
+        iosched_get_stats (&stats);
+        memcpy (buf, &stats, sizeof stats);
+        f->eax = 0;
+}
+
 bool isdir_by_fd (int fd)
 {
           struct thread *cur = thread_current ();
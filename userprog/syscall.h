@@ -1,11 +1,20 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "filesys/filesys.h"
 #include "threads/thread.h"
 #include "filesys/directory.h"
 
+/* System call numbers beyond those in lib/syscall-nr.h. */
+enum
+  {
+    SYS_PROCSTAT = SYS_INUMBER + 1,     /* Get a process's accounting. */
+    SYS_SCHEDTRACE,                     /* Read the scheduler trace. */
+    SYS_IOSTAT,                         /* Get block device statistics. */
+  };
+
 void syscall_init (void);
 
 void syscall_halt(struct intr_frame *f);
@@ -39,9 +48,15 @@ void syscall_mkdir(struct intr_frame *f,int argsNum);
 void syscall_readdir(struct intr_frame *f,int argsNum);
 void syscall_isdir(struct intr_frame *f,int argsNum);
 void syscall_inumber(struct intr_frame *f,int argsNum);
+void syscall_procstat(struct intr_frame *f,int argsNum);
+void syscall_schedtrace(struct intr_frame *f,int argsNum);
+void syscall_iostat(struct intr_frame *f,int argsNum);
 
 struct lock FILELOCK;
 
+bool filelock_acquire (void);
+void filelock_release (bool acquired);
+
 int currentFd(struct thread *cur);
 
 struct file* getFile(int fd,struct thread *cur);